@@ -0,0 +1,125 @@
+// compression ratio and throughput of compressed file transfers for several zlib levels, on text made from the
+// repository's sources and on random bytes, which the sample check sends as they are
+// usage: bench_compression [size in MB], run from 'src/'
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "../src/compression.h"
+#include "../src/content_hash.h"
+
+
+#define MB (1024LL * 1024)
+#define LINK_SPEED (100.0 / 8 * 1000 * 1000) // bytes per second of the 100 Mbit/s link transfer times are estimated for
+#define TEXT_PATH "/tmp/bench_compression_text"
+#define RANDOM_PATH "/tmp/bench_compression_random"
+#define RECEIVED_PATH "/tmp/bench_compression_received"
+
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void write_file(const char *path, const std::string &contents) {
+    FILE *file = fopen(path, "w");
+    fwrite(contents.data(), 1, contents.size(), file);
+    fclose(file);
+}
+
+// the sources and readme of the repository repeated up to size bytes
+std::string text_contents(size_t size) {
+    std::string sources;
+    for (const char *path : {"../src/super_peer.cpp", "../src/leaf_node.cpp", "../src/protocol.h", "../src/remote_files.h",
+                             "../src/files_index.h", "../README.txt"}) {
+        std::ifstream file(path);
+        std::stringstream contents;
+        contents << file.rdbuf();
+        sources += contents.str();
+    }
+    if (sources.empty())
+        sources = "no sources found, run from 'src/'\n";
+    std::string text;
+    while (text.size() < size)
+        text += sources;
+    text.resize(size);
+    return text;
+}
+
+// compress a whole file the way a node server does, then send the chunks over a socket pair into another file
+void run(const char *path, int64_t size, int level) {
+    int fd = open(path, O_RDONLY);
+    auto start = std::chrono::steady_clock::now();
+    bool sample = compressible(fd, size, level);
+    double sample_ms = seconds_since(start) * 1000;
+
+    start = std::chrono::steady_clock::now();
+    CompressedFiles::chunks chunks;
+    int64_t sent_size = 0;
+    std::string chunk;
+    for (int64_t offset = 0; offset < size; offset += COMPRESS_CHUNK_SIZE) {
+        compress_file_chunk(fd, offset, std::min<int64_t>(COMPRESS_CHUNK_SIZE, size - offset), level, chunk);
+        chunks.push_back(chunk);
+        sent_size += chunk.size();
+    }
+    double compress_seconds = seconds_since(start);
+
+    // serve the chunks as a cached file would be, timing the client decompressing and writing them
+    int received_fd = open(RECEIVED_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0)
+        exit(1);
+    Protocol server_protocol, client_protocol;
+    start = std::chrono::steady_clock::now();
+    std::thread server([&]{
+        for (auto&& chunk : chunks)
+            server_protocol.send_all(sockets[0], chunk.data(), chunk.size());
+    });
+    int64_t received = recv_compressed(client_protocol, sockets[1], received_fd, 0, size);
+    server.join();
+    double receive_seconds = seconds_since(start);
+    bool correct = received == size && hash_file(received_fd) == hash_file(fd);
+
+    std::cout << level << "\t" << (sample ? "yes" : "no") << "\t" << sample_ms << "\t\t" << (double)size / sent_size
+              << "\t" << size / MB / compress_seconds << "\t\t" << size / MB / receive_seconds << "\t\t"
+              << size / LINK_SPEED << "\t\t" << sent_size / LINK_SPEED << "\t\t" << (correct ? "yes" : "no") << std::endl;
+    close(sockets[0]);
+    close(sockets[1]);
+    close(fd);
+    close(received_fd);
+}
+
+int main(int argc, char *argv[]) {
+    int64_t size = (int64_t)((argc > 1 ? atof(argv[1]) : 64) * MB);
+    write_file(TEXT_PATH, text_contents(size));
+    std::string random_bytes(size, '\0');
+    std::mt19937_64 random_engine(1);
+    for (int64_t i = 0; i < size; i++)
+        random_bytes[i] = (char)random_engine();
+    write_file(RANDOM_PATH, random_bytes);
+
+    std::cout << "file: " << size / MB << " MB, chunks of " << COMPRESS_CHUNK_SIZE / 1024 << " KB" << std::endl;
+    for (int random = 0; random <= 1; random++) {
+        const char *path = random ? RANDOM_PATH : TEXT_PATH;
+        std::cout << std::endl << (random ? "random bytes" : "text") << std::endl;
+        std::cout << "level\tsample\tsample ms\tratio\tcompress MB/s\tcached MB/s\tuncompressed s\tcompressed s\tcorrect"
+                  << std::endl;
+        for (int level : {1, 3, 6, 9})
+            run(path, size, level);
+    }
+    std::cout << std::endl << "cached MB/s is a client receiving and decompressing a file served from the cache over a socket pair,"
+              << std::endl << "uncompressed and compressed s are the time to send the file over a 100 Mbit/s link" << std::endl;
+    remove(TEXT_PATH);
+    remove(RANDOM_PATH);
+    remove(RECEIVED_PATH);
+    return 0;
+}
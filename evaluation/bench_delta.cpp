@@ -0,0 +1,110 @@
+// bytes sent to refresh a cached copy of a large file after small edits at the origin, comparing the whole file
+// an obtain sends with the signatures and delta of a delta refresh
+// usage: bench_delta [size in MB]
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "../src/content_hash.h"
+#include "../src/delta.h"
+
+
+#define MB (1024LL * 1024)
+#define OLD_PATH "/tmp/bench_delta_old"
+#define NEW_PATH "/tmp/bench_delta_new"
+#define REBUILT_PATH "/tmp/bench_delta_rebuilt"
+
+
+std::mt19937_64 random_engine(1);
+
+std::string random_bytes(size_t size) {
+    std::string data(size, '\0');
+    for (size_t i = 0; i < size; i++)
+        data[i] = (char)random_engine();
+    return data;
+}
+
+// the new file is the old one with edit applied to its contents
+void write_new_file(const std::string &old_contents, std::function<void(std::string &)> edit) {
+    std::string contents = old_contents;
+    edit(contents);
+    FILE *file = fopen(NEW_PATH, "w");
+    fwrite(contents.data(), 1, contents.size(), file);
+    fclose(file);
+}
+
+// refresh the old copy over a socket pair, the node server's side on its own thread
+void run(const char *name) {
+    int old_fd = open(OLD_PATH, O_RDONLY), new_fd = open(NEW_PATH, O_RDONLY);
+    int rebuilt_fd = open(REBUILT_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    struct stat old_stat, new_stat;
+    fstat(old_fd, &old_stat);
+    fstat(new_fd, &new_stat);
+
+    auto start = std::chrono::steady_clock::now();
+    int block_size = delta_block_size(old_stat.st_size);
+    std::string signatures;
+    delta_signatures(old_fd, old_stat.st_size, block_size, signatures);
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0)
+        exit(1);
+    Protocol server_protocol, client_protocol;
+    std::thread server([&]{
+        int64_t literal_bytes;
+        send_delta(server_protocol, sockets[0], new_fd, new_stat.st_size, block_size, signatures, literal_bytes);
+    });
+    int64_t literal_bytes;
+    int64_t size = recv_delta(client_protocol, sockets[1], old_fd, old_stat.st_size, block_size, rebuilt_fd, literal_bytes);
+    server.join();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    bool correct = size == new_stat.st_size && hash_file(rebuilt_fd) == hash_file(new_fd);
+    int64_t sent = signatures.size() + server_protocol.bytes_sent;
+    std::cout << name << "\t" << new_stat.st_size << "\t\t" << signatures.size() << "\t\t" << server_protocol.bytes_sent
+              << "\t\t" << 100.0 * sent / new_stat.st_size << "\t\t" << ms << "\t\t" << (correct ? "yes" : "no") << std::endl;
+    close(sockets[0]);
+    close(sockets[1]);
+    close(old_fd);
+    close(new_fd);
+    close(rebuilt_fd);
+}
+
+
+int main(int argc, char *argv[]) {
+    size_t size = (size_t)((argc > 1 ? atof(argv[1]) : 256) * MB);
+    std::string old_contents = random_bytes(size);
+    FILE *file = fopen(OLD_PATH, "w");
+    fwrite(old_contents.data(), 1, old_contents.size(), file);
+    fclose(file);
+
+    std::cout << "file: " << size / MB << " MB, block size " << delta_block_size(size) << " bytes" << std::endl;
+    std::cout << "edit\t\t\twhole file\tsignatures\tdelta\t\t% of whole file\tms\t\tcorrect" << std::endl;
+    write_new_file(old_contents, [](std::string &c) { c.replace(c.size() / 2, 100, random_bytes(100)); });
+    run("100 bytes overwritten\t");
+    write_new_file(old_contents, [](std::string &c) { c.insert(1000, random_bytes(100)); });
+    run("100 bytes inserted\t");
+    write_new_file(old_contents, [](std::string &c) { c.erase(c.size() / 3, 1000); });
+    run("1000 bytes deleted\t");
+    write_new_file(old_contents, [](std::string &c) { c += random_bytes(4096); });
+    run("4 KB appended\t\t");
+    write_new_file(old_contents, [](std::string &c) {
+        for (int i = 0; i < 16; i++)
+            c.replace(random_engine() % (c.size() - 100), 100, random_bytes(100));
+    });
+    run("16 edits of 100 bytes");
+    write_new_file(old_contents, [](std::string &c) { c = random_bytes(c.size()); });
+    run("whole file replaced\t");
+    remove(OLD_PATH);
+    remove(NEW_PATH);
+    remove(REBUILT_PATH);
+    return 0;
+}
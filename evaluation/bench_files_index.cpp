@@ -0,0 +1,150 @@
+// compares the sharded files index against the original single lock map
+// under a mix of re-registrations, file changes and searches from many threads,
+// and the cost of a leaf node leaving as the index grows
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../src/files_index.h"
+
+
+#define FILES 10000
+#define NODES 100
+#define OPERATIONS 200000 // per thread
+
+// out of every 100 operations, the rest are re-registrations of files already in the index
+#define SEARCH_PERCENT 10
+#define CHANGE_PERCENT 1
+
+
+// the files index as it was before sharding, a single map behind a single lock
+class LockedIndex {
+    private:
+        std::unordered_map<std::string, std::vector<int>> _files_index;
+        std::mutex _files_index_m;
+
+    public:
+        void add(const std::string &filename, int id) {
+            std::lock_guard<std::mutex> guard(_files_index_m);
+            if (!(std::find(_files_index[filename].begin(), _files_index[filename].end(), id) != _files_index[filename].end()))
+                _files_index[filename].push_back(id);
+        }
+
+        void remove(const std::string &filename, int id) {
+            std::lock_guard<std::mutex> guard(_files_index_m);
+            _files_index[filename].erase(std::remove(_files_index[filename].begin(),
+                                            _files_index[filename].end(), id), _files_index[filename].end());
+            if (_files_index[filename].size() == 0)
+                _files_index.erase(filename);
+        }
+
+        // copies the whole index without the node, the way disconnects were handled before
+        void remove_id(int id) {
+            std::unordered_map<std::string, std::vector<int>> tmp_files_index;
+            std::lock_guard<std::mutex> guard(_files_index_m);
+            for (auto const &file_index : _files_index) {
+                std::vector<int> ids = file_index.second;
+                ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+                if (ids.size() > 0)
+                    tmp_files_index[file_index.first] = ids;
+            }
+            _files_index = tmp_files_index;
+        }
+
+        std::vector<int> find(const std::string &filename) {
+            std::lock_guard<std::mutex> guard(_files_index_m);
+            auto it = _files_index.find(filename);
+            return (it != _files_index.end()) ? it->second : std::vector<int>();
+        }
+};
+
+
+template<typename Index>
+void run(const char *name, int threads) {
+    Index index;
+    std::vector<std::string> filenames;
+    for (int i = 0; i < FILES; i++)
+        filenames.push_back("file" + std::to_string(i) + ".txt");
+    for (int i = 0; i < FILES; i++)
+        index.add(filenames[i], i % NODES);
+
+    std::vector<std::vector<double>> latencies(threads);
+    std::atomic<long> found{0};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]{
+            std::mt19937 random(t);
+            for (int i = 0; i < OPERATIONS; i++) {
+                int r = random() % 100;
+                int file = random() % FILES;
+                if (r < SEARCH_PERCENT) {
+                    auto search_start = std::chrono::steady_clock::now();
+                    found += index.find(filenames[file]).size();
+                    latencies[t].push_back(std::chrono::duration<double, std::micro>(
+                        std::chrono::steady_clock::now() - search_start).count());
+                }
+                else if (r < SEARCH_PERCENT + CHANGE_PERCENT) {
+                    // a node modifies a file, deregistering and registering it again
+                    index.remove(filenames[file], file % NODES);
+                    index.add(filenames[file], file % NODES);
+                }
+                else
+                    index.add(filenames[file], file % NODES);
+            }
+        });
+    }
+    for (auto&& w : workers)
+        w.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    for (auto&& l : latencies)
+        all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+    double p99 = all.empty() ? 0 : all[all.size() * 99 / 100];
+
+    std::cout << name << "\t" << threads << "\t" << (long)(threads * OPERATIONS / seconds) << "\t"
+              << p99 << std::endl;
+}
+
+
+// time a leaf node with a handful of files leaving and joining an index of a given size
+template<typename Index>
+void churn(const char *name, int files) {
+    Index index;
+    for (int i = 0; i < files; i++)
+        index.add("file" + std::to_string(i) + ".txt", NODES + i % NODES);
+
+    int departures = 100;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < departures; i++) {
+        for (int f = 0; f < 10; f++)
+            index.add("leaf" + std::to_string(f) + ".txt", 0);
+        index.remove_id(0);
+    }
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    std::cout << name << "\t" << files << "\t" << us / departures << std::endl;
+}
+
+
+int main() {
+    std::cout << "index\tthreads\tops/sec\tsearch p99 (us)" << std::endl;
+    for (int threads : {1, 2, 4, 8, 16}) {
+        run<LockedIndex>("locked", threads);
+        run<FilesIndex>("sharded", threads);
+    }
+
+    std::cout << "\nindex\tfiles\tjoin and leave (us)" << std::endl;
+    for (int files : {1000, 10000, 100000}) {
+        churn<LockedIndex>("locked", files);
+        churn<FilesIndex>("sharded", files);
+    }
+    return 0;
+}
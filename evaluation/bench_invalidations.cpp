@@ -0,0 +1,95 @@
+// simulates the invalidations a super peer sends while its leaf nodes modify files,
+// comparing sending each one right away against batching them over several window sizes
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "../src/invalidation_batcher.h"
+
+
+#define PEERS 9 // neighbor peers of a 10 peer mesh
+#define LEAVES 20 // leaf nodes attached to the super peer
+#define COPIES 4 // leaf nodes caching each file
+#define FILES 10 // files being modified
+#define DURATION 600 // simulated seconds
+
+
+struct result {
+    double messages_per_second = 0;
+    double invalidations_per_second = 0;
+    double superseded_percent = 0;
+    double mean_staleness = 0; // milliseconds between a modification and its invalidation being sent
+    uint64_t max_staleness = 0;
+};
+
+// modifications arrive at random at rate per second, each one invalidating every copy and every neighbor peer
+result run(double rate, int window) {
+    std::mt19937 random(1);
+    std::exponential_distribution<double> gap(rate / 1000);
+    std::vector<std::vector<int>> copies(FILES);
+    for (int f = 0; f < FILES; f++) {
+        for (int c = 0; c < COPIES; c++)
+            copies[f].push_back(PEERS + (f * COPIES + c) % LEAVES);
+    }
+
+    InvalidationBatcher batcher;
+    result r;
+    uint64_t messages = 0, sent = 0, staleness = 0;
+    uint64_t flush = window;
+    auto send = [&](uint64_t now) {
+        for (auto&& x : batcher.take()) {
+            messages++;
+            for (auto&& p : x.second) {
+                sent++;
+                staleness += now - p.queued;
+                r.max_staleness = std::max(r.max_staleness, now - p.queued);
+            }
+        }
+    };
+
+    double t = 0;
+    int version = 0;
+    while ((t += gap(random)) < DURATION * 1000) {
+        uint64_t now = (uint64_t)t;
+        // batches go out at the end of every window that passed before this modification
+        while (window > 0 && flush <= now) {
+            send(flush);
+            flush += window;
+        }
+        message msg;
+        msg.type = NODE_INVALIDATE;
+        msg.id = 55010;
+        msg.filename = "file" + std::to_string(random() % FILES) + ".txt";
+        msg.version = ++version;
+        std::vector<int> destinations = copies[msg.filename[4] - '0'];
+        for (int peer = 0; peer < PEERS; peer++)
+            destinations.push_back(peer);
+        for (auto&& destination : destinations)
+            batcher.add(destination, msg, now);
+        if (window == 0)
+            send(now);
+    }
+    send(flush);
+
+    r.messages_per_second = (double)messages / DURATION;
+    r.invalidations_per_second = (double)sent / DURATION;
+    r.superseded_percent = 100.0 * batcher.superseded / batcher.added;
+    r.mean_staleness = sent ? (double)staleness / sent : 0;
+    return r;
+}
+
+
+int main() {
+    // about the rate of the evaluation script, and a burst of saves
+    for (double rate : {2.0, 20.0}) {
+        std::cout << "\nmodifications/sec: " << rate << std::endl;
+        std::cout << "window (ms)\tmessages/sec\tinvalidations/sec\tsuperseded %\tstaleness mean (ms)\tstaleness max (ms)" << std::endl;
+        for (int window : {0, 50, 100, 250, 500, 1000, 2000}) {
+            result r = run(rate, window);
+            std::cout << window << "\t\t" << r.messages_per_second << "\t\t" << r.invalidations_per_second << "\t\t\t"
+                      << r.superseded_percent << "\t\t" << r.mean_staleness << "\t\t\t" << r.max_staleness << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+// compares the cost of a log line on the thread writing it, between the original locked
+// stream logging and the ring buffer logger, with the stdout echo on and off
+#include <stdio.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../src/logger.h"
+
+
+#define LINES 40000 // per thread
+#define BURST 200 // lines logged back to back before a pause
+#define BURST_PAUSE 5 // milliseconds between bursts
+
+
+// logging as it was, every line written to the file and stdout under a single lock and flushed
+class LockedLogger {
+    private:
+        std::ofstream _server_logs;
+        std::mutex _log_m;
+        bool _echo;
+
+        std::string time_now() {
+            std::chrono::high_resolution_clock::duration now = std::chrono::high_resolution_clock::now().time_since_epoch();
+            std::chrono::microseconds now_ms = std::chrono::duration_cast<std::chrono::microseconds>(now);
+            return std::to_string(now_ms.count());
+        }
+
+    public:
+        LockedLogger(std::string path, bool echo) : _server_logs(path), _echo(echo) {}
+
+        void log(std::string type, std::string msg) {
+            std::lock_guard<std::mutex> guard(_log_m);
+            _server_logs << '[' << time_now() << "] [" << type << "] " << msg  << '\n' << std::endl;
+            if (_echo)
+                std::cout << '[' << time_now() << "] [" << type << "] [" << msg  << "]\n" << std::endl;
+        }
+};
+
+
+// nanoseconds a logging thread spends per line, counting only the time inside the log calls
+// lines come in bursts with a pause after each, the way the forwarding path logs every message of a query
+template<typename F>
+double run(int threads, int burst, int pause, F log) {
+    std::vector<double> spent(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]{
+            for (int i = 0; i < LINES; i++) {
+                if (i % burst == 0 && i > 0)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(pause));
+                std::string msg = "msg id [55010," + std::to_string(i) + "] to peer 55001";
+                auto start = std::chrono::steady_clock::now();
+                log("forwarding message", msg);
+                spent[t] += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            }
+        });
+    }
+    for (auto&& w : workers)
+        w.join();
+    double total = 0;
+    for (auto&& x : spent)
+        total += x;
+    return total / threads / LINES;
+}
+
+template<typename F>
+void report(const char *name, int threads, F log) {
+    std::cerr << name << '\t' << threads << '\t' << run(threads, LINES, 0, log) << "\t\t"
+              << run(threads, BURST, BURST_PAUSE, log) << std::endl;
+}
+
+
+int main() {
+    // stdout goes to /dev/null so the terminal does not decide the results
+    if (freopen("/dev/null", "w", stdout) == nullptr)
+        return 1;
+    std::cerr << "logger\t\t\tthreads\tns/line sustained\tns/line in bursts" << std::endl;
+    for (int threads : {1, 2, 4, 8}) {
+        for (bool echo : {true, false}) {
+            {
+                LockedLogger locked("/tmp/bench_logger_locked.log", echo);
+                report(echo ? "locked + stdout\t" : "locked\t\t", threads,
+                       [&](const std::string &type, const std::string &msg) { locked.log(type, msg); });
+            }
+            {
+                Logger logger;
+                int sink = logger.open("/tmp/bench_logger_ring.log", LOG_DEBUG);
+                logger.echo(echo ? LOG_DEBUG : LOG_NONE);
+                logger.start();
+                report(echo ? "ring + stdout\t" : "ring\t\t", threads,
+                       [&](const std::string &type, const std::string &msg) { logger.write(sink, LOG_DEBUG, type, msg); });
+            }
+        }
+        // forwarding lines below the configured level cost no more than the check
+        Logger logger;
+        int sink = logger.open("/tmp/bench_logger_ring.log", LOG_INFO);
+        logger.start();
+        report("ring, debug filtered", threads,
+               [&](const std::string &type, const std::string &msg) { logger.write(sink, LOG_DEBUG, type, msg); });
+    }
+    remove("/tmp/bench_logger_locked.log");
+    remove("/tmp/bench_logger_ring.log");
+    return 0;
+}
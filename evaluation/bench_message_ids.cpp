@@ -0,0 +1,116 @@
+// compares the timing wheel message ids table against the original map with an xor hash
+// at the rate of messages a super peer sees while queries flood a fully connected network
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../src/message_ids.h"
+
+
+#define ORIGINS 20 // leaf node ports searching, each numbering its own messages
+#define COPIES 9 // times each message arrives, once from every neighbor of a 10 peer mesh
+#define MESSAGES 100000 // distinct messages per thread
+
+
+// the message ids list as it was, swept by a separate thread once a minute
+class LockedMessageIds {
+    private:
+        struct _message_id_hash {
+            size_t operator()(const std::pair<int, int>& p) const { return p.first ^ p.second; }
+        };
+        typedef std::pair<int, int> _message_id_t;
+
+    public:
+        std::unordered_map<_message_id_t, std::chrono::system_clock::time_point, _message_id_hash> _message_ids;
+        std::mutex _message_ids_m;
+
+        bool insert(int id, int sequence_number) {
+            _message_id_t msg_id = {id, sequence_number};
+            std::lock_guard<std::mutex> guard(_message_ids_m);
+            if (_message_ids.find(msg_id) == _message_ids.end()) {
+                _message_ids[msg_id] = std::chrono::system_clock::now();
+                return true;
+            }
+            return false;
+        }
+
+        // the periodic sweep, which holds the lock over the whole table
+        void sweep() {
+            std::lock_guard<std::mutex> guard(_message_ids_m);
+            for (auto itr = _message_ids.cbegin(); itr != _message_ids.cend();) {
+                itr = (std::chrono::duration_cast<std::chrono::minutes>(std::chrono::system_clock::now() -
+                                                    itr->second).count() > 1) ? _message_ids.erase(itr++) : ++itr;
+            }
+        }
+
+        size_t largest_bucket() {
+            size_t largest = 0;
+            for (size_t i = 0; i < _message_ids.bucket_count(); i++)
+                largest = std::max(largest, _message_ids.bucket_size(i));
+            return largest;
+        }
+};
+
+
+// every thread sees messages from all origins with rising sequence numbers, each several times
+template<typename Index>
+double run(Index &index, int threads) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&index, t]{
+            for (int i = 0; i < MESSAGES; i++) {
+                int id = 55010 + i % ORIGINS;
+                int sequence_number = t * MESSAGES / ORIGINS + i / ORIGINS;
+                for (int c = 0; c < COPIES; c++)
+                    index.insert(id, sequence_number);
+            }
+        });
+    }
+    for (auto&& w : workers)
+        w.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return threads * MESSAGES * COPIES / seconds;
+}
+
+
+int main() {
+    std::cout << "table\tthreads\tchecks/sec" << std::endl;
+    for (int threads : {1, 2, 4, 8}) {
+        LockedMessageIds locked;
+        std::cout << "xor map\t" << threads << "\t" << (long)run(locked, threads) << std::endl;
+        MessageIds wheel;
+        std::cout << "wheel\t" << threads << "\t" << (long)run(wheel, threads) << std::endl;
+    }
+
+    LockedMessageIds locked;
+    run(locked, 8);
+    std::cout << "\nxor map after " << locked._message_ids.size() << " ids: largest bucket "
+              << locked.largest_bucket() << " ids";
+    auto start = std::chrono::steady_clock::now();
+    locked.sweep();
+    std::cout << ", sweep holds the lock for "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+              << " ms" << std::endl;
+
+    // a minute of ids expiring one second at a time
+    MessageIds wheel;
+    int per_second = 8 * MESSAGES / MESSAGE_ID_SLOTS;
+    for (int second = 0; second < MESSAGE_ID_SLOTS; second++) {
+        for (int i = 0; i < per_second; i++)
+            wheel.insert(55010 + i % ORIGINS, second * per_second + i, second);
+    }
+    // the next second expires the first one while recording as many new ids, the slowest insert is the longest pause
+    double slowest = 0;
+    for (int i = 0; i < per_second; i++) {
+        start = std::chrono::steady_clock::now();
+        wheel.insert(55010 + i % ORIGINS, MESSAGE_ID_SLOTS * per_second + i, MESSAGE_ID_SLOTS);
+        slowest = std::max(slowest, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::cout << "wheel expiring a second of " << per_second << " ids: longest pause " << slowest << " ms" << std::endl;
+    return 0;
+}
@@ -0,0 +1,89 @@
+// compares the bytes and syscalls used by the framed and legacy wire formats
+// for the messages exchanged by a single search
+#include <sys/socket.h>
+
+#include <iostream>
+#include <sstream>
+
+#include "../src/protocol.h"
+
+
+#define QUERIES 1000
+
+
+// send a message from one end of a socket pair and read it back on the other
+void exchange(Protocol &protocol, int sockets[2], const message &msg, int channel) {
+    message received;
+    if (!protocol.send_message(sockets[0], msg)) {
+        std::cerr << "failed send" << std::endl;
+        exit(1);
+    }
+    bool ok = (channel == REPLY) ? protocol.recv_reply(sockets[1], msg.type, received)
+                                 : protocol.recv_message(sockets[1], channel, received) == MSG_OK;
+    if (!ok || received.filename != msg.filename || received.text != msg.text) {
+        std::cerr << "failed recv" << std::endl;
+        exit(1);
+    }
+}
+
+// a leaf node searches its super peer, which forwards the query to one neighbor over a pooled link
+void run(int wire_format, int results) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0) {
+        std::cerr << "failed socket pair" << std::endl;
+        exit(1);
+    }
+    Protocol protocol;
+    protocol.wire_format = wire_format;
+
+    std::ostringstream ids;
+    for (int i = 0; i < results; i++)
+        ids << ((i > 0) ? "," : "") << 55000 + i;
+
+    message search;
+    search.type = SEARCH;
+    search.filename = "k.txt";
+
+    message query;
+    query.type = LINK_QUERY;
+    query.ttl = 2;
+    query.id = 55010;
+    query.filename = "k.txt";
+
+    message link_reply;
+    link_reply.type = LINK_REPLY;
+    link_reply.text = ids.str();
+
+    message search_reply;
+    search_reply.type = SEARCH_REPLY;
+    search_reply.text = ids.str();
+
+    for (int i = 0; i < QUERIES; i++) {
+        query.request_id = i;
+        query.sequence_number = query.message_sequence_number = i;
+        link_reply.request_id = i;
+        exchange(protocol, sockets, search, NODE_LINK);
+        exchange(protocol, sockets, query, PEER_LINK);
+        // legacy replies are cut down to a single fixed size buffer
+        if (wire_format == LEGACY)
+            link_reply.text = search_reply.text = ids.str().substr(0, MAX_MSG_SIZE - 1);
+        exchange(protocol, sockets, link_reply, REPLY);
+        exchange(protocol, sockets, search_reply, REPLY);
+    }
+    close(sockets[0]);
+    close(sockets[1]);
+
+    std::cout << ((wire_format == LEGACY) ? "legacy" : "framed") << "\t" << results << "\t"
+              << protocol.bytes_sent / QUERIES << "\t" << protocol.send_calls / QUERIES << "\t"
+              << protocol.recv_calls / QUERIES << std::endl;
+}
+
+
+int main() {
+    std::cout << "format\tresults\tbytes/query\tsends/query\trecvs/query" << std::endl;
+    for (int results : {1, 10, 1000}) {
+        run(FRAMED, results);
+        run(LEGACY, results);
+    }
+    return 0;
+}
@@ -0,0 +1,137 @@
+// receive throughput of a downloaded file over loopback, comparing the original recv and fwrite loop,
+// the recv and pwrite loop, and splicing into a preallocated part file which is renamed into place
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#include "../src/transfer.h"
+
+
+#define MB (1024LL * 1024)
+#define TOTAL (2048 * MB) // bytes received for every size, spread over as many files as needed
+#define SOURCE_PATH "/tmp/bench_receive_source"
+#define DESTINATION_PATH "/tmp/bench_receive_file"
+#define PART_PATH "/tmp/bench_receive_file.part"
+
+
+// sends the first size bytes of the source file on every connection, the way a node server answers an obtain
+void serve(int listen_fd, std::atomic<int64_t> *size) {
+    int fd = open(SOURCE_PATH, O_RDONLY);
+    while (1) {
+        int socket_fd = accept(listen_fd, nullptr, nullptr);
+        if (socket_fd < 0)
+            return;
+        send_file_range(socket_fd, fd, 0, *size);
+        close(socket_fd);
+    }
+}
+
+int connect_to(int port) {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(socket_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return -1;
+    return socket_fd;
+}
+
+// the download loop obtain_request used to have
+int64_t receive_fwrite(int socket_fd, int64_t size) {
+    FILE *file = fopen(DESTINATION_PATH, "w");
+    char buffer[MAX_MSG_SIZE];
+    int64_t remaining_size = size;
+    ssize_t received_size;
+    while ((remaining_size > 0) &&
+           ((received_size = recv(socket_fd, buffer, std::min<int64_t>(sizeof(buffer), remaining_size), 0)) > 0)) {
+        fwrite(buffer, sizeof(char), received_size, file);
+        remaining_size -= received_size;
+    }
+    fclose(file);
+    return size - remaining_size;
+}
+
+int64_t receive_pwrite(int socket_fd, int64_t size) {
+    int fd = open(DESTINATION_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int64_t received = recv_file_copy(socket_fd, fd, 0, size);
+    close(fd);
+    return received;
+}
+
+// the download path obtain_request has now
+int64_t receive_splice(int socket_fd, int64_t size) {
+    int fd = open(PART_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int64_t received = recv_file_range(socket_fd, fd, 0, size);
+    close(fd);
+    rename(PART_PATH, DESTINATION_PATH);
+    return received;
+}
+
+// MB/s over TOTAL bytes of files of the given size, counting from connecting to the file being in place
+double run(int port, std::atomic<int64_t> *server_size, int64_t size, std::function<int64_t(int, int64_t)> receive) {
+    *server_size = size;
+    int64_t files = std::max<int64_t>(TOTAL / size, 1);
+    double seconds = 0;
+    for (int64_t i = 0; i < files; i++) {
+        remove(DESTINATION_PATH);
+        auto start = std::chrono::steady_clock::now();
+        int socket_fd = connect_to(port);
+        int64_t received = receive(socket_fd, size);
+        close(socket_fd);
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (received != size) {
+            std::cerr << "short transfer" << std::endl;
+            exit(1);
+        }
+    }
+    remove(DESTINATION_PATH);
+    return (double)(files * size) / MB / seconds;
+}
+
+
+int main() {
+    // random contents, so nothing along the way can shortcut zeros
+    std::mt19937_64 random(1);
+    std::string block(MB, '\0');
+    for (size_t i = 0; i < block.size(); i += sizeof(uint64_t)) {
+        uint64_t value = random();
+        memcpy(&block[i], &value, sizeof(value));
+    }
+    int fd = open(SOURCE_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    for (int i = 0; i < 1024; i++) {
+        if (write(fd, block.data(), block.size()) != (ssize_t)block.size())
+            return 1;
+    }
+    close(fd);
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_size = sizeof(addr);
+    if (bind(listen_fd, (struct sockaddr *)&addr, addr_size) < 0 || listen(listen_fd, 5) < 0 ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &addr_size) < 0)
+        return 1;
+    int port = ntohs(addr.sin_port);
+    std::atomic<int64_t> server_size{0};
+    std::thread server(serve, listen_fd, &server_size);
+    server.detach();
+
+    std::cout << "file size (MB)\trecv + fwrite (MB/s)\trecv + pwrite (MB/s)\tsplice + fallocate + rename (MB/s)" << std::endl;
+    for (int64_t size : {MB, 16 * MB, 256 * MB, 1024 * MB}) {
+        std::cout << size / MB << "\t\t" << run(port, &server_size, size, receive_fwrite) << "\t\t\t"
+                  << run(port, &server_size, size, receive_pwrite) << "\t\t\t"
+                  << run(port, &server_size, size, receive_splice) << std::endl;
+    }
+    remove(SOURCE_PATH);
+    return 0;
+}
@@ -0,0 +1,155 @@
+// transfers a multi-GB file the way a node server sends an obtain, with the server dropping the
+// connection at random points, comparing a client which continues its part file with one which starts over
+// usage: bench_resume [size in GB] [mean GB between disconnects]
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "../src/protocol.h"
+#include "../src/transfer.h"
+
+
+#define GB (1024LL * 1024 * 1024)
+#define MAX_ATTEMPTS 12 // connections a client makes before giving up on the file
+#define SOURCE_PATH "/tmp/bench_resume_source"
+#define PART_PATH "/tmp/bench_resume.part"
+
+
+// marked offsets around the 31 and 32 bit boundaries and the end, checked after every complete transfer
+const int64_t marks[] = {0, 2 * GB - 1, 2 * GB, 4 * GB - 1, 4 * GB, 4 * GB + 1};
+
+
+Protocol protocol;
+int64_t file_size;
+double mean_disconnect;
+std::mt19937_64 random_engine(1);
+
+// serves one part request per connection like handle_obtain_request, but stops after a random number of bytes
+void serve(int listen_fd) {
+    std::exponential_distribution<double> disconnect(1.0 / mean_disconnect);
+    int fd = open(SOURCE_PATH, O_RDONLY);
+    while (1) {
+        int socket_fd = accept(listen_fd, nullptr, nullptr);
+        if (socket_fd < 0)
+            return;
+        message msg, reply;
+        if (protocol.recv_message(socket_fd, LEAF_NODE_CONNECTION, msg) == MSG_OK) {
+            reply.type = OBTAIN_PART_REPLY;
+            reply.size = file_size;
+            reply.id = 1;
+            reply.version = 1;
+            if (msg.id == reply.id && msg.version == reply.version && msg.offset >= 0 && msg.offset <= file_size)
+                reply.offset = msg.offset;
+            int64_t length = std::min<int64_t>(msg.size, file_size - reply.offset);
+            length = std::min<int64_t>(length, (int64_t)disconnect(random_engine));
+            if (protocol.send_message(socket_fd, reply))
+                send_file_range(socket_fd, fd, reply.offset, length);
+        }
+        close(socket_fd);
+    }
+}
+
+int connect_to(int port) {
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(socket_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(socket_fd);
+        return -1;
+    }
+    return socket_fd;
+}
+
+// download the whole file, continuing the part file after a disconnect if resume is set
+void run(const char *name, int port, bool resume) {
+    remove(PART_PATH);
+    int64_t received_total = 0;
+    int attempts = 0;
+    bool complete = false;
+    auto start = std::chrono::steady_clock::now();
+    while (!complete && attempts < MAX_ATTEMPTS) {
+        attempts++;
+        struct stat part_stat;
+        message msg, reply;
+        msg.type = OBTAIN_PART;
+        msg.filename = "source";
+        msg.size = INT64_MAX;
+        if (resume && stat(PART_PATH, &part_stat) == 0) {
+            msg.id = 1;
+            msg.version = 1;
+            msg.offset = part_stat.st_size;
+        }
+        int socket_fd = connect_to(port);
+        if (socket_fd < 0 || !protocol.send_message(socket_fd, msg) || !protocol.recv_reply(socket_fd, OBTAIN_PART_REPLY, reply)) {
+            std::cerr << "connection failed" << std::endl;
+            exit(1);
+        }
+        int fd = open(PART_PATH, O_WRONLY | O_CREAT, 0644);
+        if (ftruncate(fd, reply.offset) < 0)
+            exit(1);
+        int64_t received = recv_file_range(socket_fd, fd, reply.offset, reply.size - reply.offset);
+        close(fd);
+        close(socket_fd);
+        received_total += received;
+        complete = reply.offset + received == reply.size;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // every marked offset must hold its own value, which a 32 bit size or offset would have lost
+    bool valid = complete;
+    int fd = open(PART_PATH, O_RDONLY);
+    for (int64_t mark : marks) {
+        char expected = (char)(mark % 251 + 1), found = 0;
+        if (mark < file_size && (pread(fd, &found, 1, mark) != 1 || found != expected))
+            valid = false;
+    }
+    close(fd);
+    remove(PART_PATH);
+    std::cout << name << "\t\t" << attempts << "\t\t" << (double)received_total / GB << "\t\t"
+              << (complete ? std::to_string(seconds) : "gave up") << "\t\t" << (valid ? "yes" : "no") << std::endl;
+}
+
+
+int main(int argc, char *argv[]) {
+    file_size = (int64_t)((argc > 1 ? atof(argv[1]) : 5) * GB);
+    mean_disconnect = (argc > 2 ? atof(argv[2]) : 1) * GB;
+
+    // a sparse source file with single bytes written at the marked offsets
+    int fd = open(SOURCE_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, file_size) < 0)
+        return 1;
+    for (int64_t mark : marks) {
+        char value = (char)(mark % 251 + 1);
+        if (mark < file_size && pwrite(fd, &value, 1, mark) != 1)
+            return 1;
+    }
+    close(fd);
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_size = sizeof(addr);
+    if (bind(listen_fd, (struct sockaddr *)&addr, addr_size) < 0 || listen(listen_fd, 5) < 0 ||
+        getsockname(listen_fd, (struct sockaddr *)&addr, &addr_size) < 0)
+        return 1;
+    std::thread server(serve, listen_fd);
+    server.detach();
+
+    std::cout << "file: " << (double)file_size / GB << " GB, mean between disconnects: " << mean_disconnect / GB << " GB" << std::endl;
+    std::cout << "client\t\tconnections\tGB received\tseconds\t\t\tcomplete and correct" << std::endl;
+    run("resume", ntohs(addr.sin_port), true);
+    run("restart", ntohs(addr.sin_port), false);
+    remove(SOURCE_PATH);
+    return 0;
+}
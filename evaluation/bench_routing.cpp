@@ -0,0 +1,217 @@
+// simulates searches over a network config to compare flooding with routing summaries
+// usage: bench_routing [config_path] [data_path]
+#include <dirent.h>
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include "../src/routing_summary.h"
+
+
+struct super_peer {
+    std::vector<int> peers;
+    std::set<std::string> files; // every file registered by the peer's leaf nodes
+    std::map<int, RoutingSummary> received; // latest summary from each neighbor
+};
+
+std::map<int, super_peer> network;
+int ttl;
+
+
+std::vector<int> comma_delim_ints_to_vector(std::string s) {
+    std::vector<int> result;
+    std::stringstream ss(s);
+    std::string substr;
+    while (std::getline(ss, substr, ','))
+        result.push_back(atoi(substr.c_str()));
+    return result;
+}
+
+std::vector<std::string> list_files(std::string path) {
+    std::vector<std::string> files;
+    if (DIR *directory = opendir(path.c_str())) {
+        while (auto file = readdir(directory)) {
+            if (file->d_name[0] != '.')
+                files.push_back(file->d_name);
+        }
+        closedir(directory);
+    }
+    return files;
+}
+
+// reads the topology the same way the peers do, with each leaf node's files taken from its data directory
+void load(std::string config_path, std::string data_path) {
+    std::ifstream config(config_path);
+    int consistency_method, ttr, member_type, id, port;
+    std::string tmp;
+    config >> consistency_method;
+    if (consistency_method != 0)
+        config >> ttr;
+    config >> ttl;
+    while (config >> member_type) {
+        if (member_type == 0) {
+            std::string peers, nodes;
+            config >> id >> port >> peers >> nodes;
+            network[port].peers = comma_delim_ints_to_vector(peers);
+        }
+        else if (member_type == 1) {
+            int peer;
+            config >> id >> port >> peer;
+            for (auto&& file : list_files(data_path + "/n" + std::to_string(id)))
+                network[peer].files.insert(file);
+        }
+        else
+            std::getline(config, tmp);
+    }
+}
+
+// one round of every super peer sending each neighbor a summary built from what it received last round
+void exchange_summaries(uint32_t bits) {
+    std::map<int, std::map<int, RoutingSummary>> sent;
+    for (auto&& x : network) {
+        BloomFilter local(bits);
+        for (auto&& file : x.second.files)
+            local.add(file);
+        for (auto&& peer : x.second.peers) {
+            std::vector<const RoutingSummary *> neighbors;
+            for (auto&& neighbor : x.second.peers) {
+                if (neighbor == peer)
+                    continue;
+                auto it = x.second.received.find(neighbor);
+                neighbors.push_back((it != x.second.received.end()) ? &it->second : nullptr);
+            }
+            sent[peer][x.first] = RoutingSummary::build(local, neighbors, ttl + 1);
+        }
+    }
+    for (auto&& x : sent)
+        network[x.first].received = x.second;
+}
+
+// checks if filename is registered within hops of a super peer
+bool reachable(int from, const std::string &filename, int hops) {
+    std::map<int, int> distance = {{from, 0}};
+    std::queue<int> pending;
+    pending.push(from);
+    while (!pending.empty()) {
+        int peer = pending.front();
+        pending.pop();
+        if (network[peer].files.count(filename))
+            return true;
+        if (distance[peer] == hops)
+            continue;
+        for (auto&& next : network[peer].peers) {
+            if (!distance.count(next)) {
+                distance[next] = distance[peer] + 1;
+                pending.push(next);
+            }
+        }
+    }
+    return false;
+}
+
+struct query_stats {
+    long messages = 0;
+    long false_positives = 0;
+    long true_negatives = 0;
+    std::set<int> found;
+};
+
+// flood a query the way super peers do, dropping messages already seen and forwarding while ttl is left
+query_stats search(int origin, const std::string &filename, bool summaries) {
+    query_stats stats;
+    std::set<int> seen = {origin};
+    std::queue<std::pair<int, int>> pending; // peer and the ttl left when it receives the query
+
+    auto forward = [&](int from, int hops) {
+        for (auto&& peer : network[from].peers) {
+            if (summaries) {
+                auto it = network[from].received.find(peer);
+                bool maybe = it == network[from].received.end() || it->second.might_reach(filename, hops);
+                if (!reachable(peer, filename, hops)) {
+                    if (maybe)
+                        stats.false_positives++;
+                    else
+                        stats.true_negatives++;
+                }
+                if (!maybe)
+                    continue;
+            }
+            stats.messages++;
+            pending.push({peer, hops});
+        }
+    };
+
+    if (network[origin].files.count(filename))
+        stats.found.insert(origin);
+    forward(origin, ttl);
+    while (!pending.empty()) {
+        int peer = pending.front().first;
+        int hops = pending.front().second;
+        pending.pop();
+        if (!seen.insert(peer).second)
+            continue;
+        if (network[peer].files.count(filename))
+            stats.found.insert(peer);
+        if (hops > 0)
+            forward(peer, hops - 1);
+    }
+    return stats;
+}
+
+
+// search every filename from every super peer, comparing flooding to routing with the current summaries
+void run(const std::set<std::string> &filenames, uint32_t bits) {
+    long queries = 0, flood_messages = 0, routed_messages = 0, false_positives = 0, negatives = 0, lost = 0;
+    for (auto&& x : network) {
+        for (auto&& filename : filenames) {
+            query_stats flood = search(x.first, filename, false);
+            query_stats routed = search(x.first, filename, true);
+            queries++;
+            flood_messages += flood.messages;
+            routed_messages += routed.messages;
+            false_positives += routed.false_positives;
+            negatives += routed.false_positives + routed.true_negatives;
+            if (routed.found != flood.found)
+                lost++;
+        }
+    }
+
+    size_t summary_bytes = network.begin()->second.received.begin()->second.encode().size();
+    std::cout << "\nsummary bits per level: " << bits << " (" << summary_bytes << " bytes per summary)" << std::endl;
+    std::cout << "flooding messages/query: " << (double)flood_messages / queries << std::endl;
+    std::cout << "summary messages/query: " << (double)routed_messages / queries << std::endl;
+    std::cout << "messages saved/query: " << (double)(flood_messages - routed_messages) / queries << std::endl;
+    std::cout << "false positive rate: " << ((negatives > 0) ? (double)false_positives / negatives : 0) << std::endl;
+    std::cout << "queries with different results: " << lost << std::endl;
+}
+
+
+int main(int argc, char *argv[]) {
+    load((argc > 1) ? argv[1] : "../config/push.cfg", (argc > 2) ? argv[2] : "../data");
+
+    // every indexed file, and as many names nobody has
+    std::set<std::string> filenames;
+    for (auto&& x : network)
+        filenames.insert(x.second.files.begin(), x.second.files.end());
+    size_t indexed = filenames.size();
+    for (size_t i = 0; i < indexed; i++)
+        filenames.insert("missing" + std::to_string(i) + ".txt");
+    std::cout << "super peers: " << network.size() << ", ttl: " << ttl << ", files: " << indexed
+              << " (+" << indexed << " missing), queries: " << network.size() * filenames.size() << std::endl;
+
+    // smaller summaries than the default show how false positives eat into the savings
+    for (uint32_t bits : {256, 1024, SUMMARY_BITS}) {
+        for (auto&& x : network)
+            x.second.received.clear();
+        // summaries settle once they have travelled ttl hops
+        for (int i = 0; i <= ttl + 1; i++)
+            exchange_summaries(bits);
+        run(filenames, bits);
+    }
+    return 0;
+}
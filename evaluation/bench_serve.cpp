@@ -0,0 +1,117 @@
+// time a node server spends finding and opening a file for each obtain of a few hot files, opening the local path,
+// then the remote path, then stating and closing the file every time, against the served files kept open
+// each serve then sends the file into a socket the way an obtain does
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../src/served_files.h"
+#include "../src/transfer.h"
+
+
+#define DIRECTORY "/tmp/bench_serve/"
+#define FILES 16 // hot files, all cached copies in the remote files directory
+#define SERVES 200000 // per thread
+
+
+std::string name(int i) {
+    return "hot" + std::to_string(i) + ".txt";
+}
+
+// the original lookup, a failed open in the local files directory before the remote files directory
+std::shared_ptr<OpenFile> open_file(const std::string &filename, int64_t &size) {
+    int fd = open((DIRECTORY "local/" + filename).c_str(), O_RDONLY);
+    if (fd == -1)
+        fd = open((DIRECTORY "remote/" + filename).c_str(), O_RDONLY);
+    if (fd == -1)
+        return nullptr;
+    auto file = std::make_shared<OpenFile>(fd);
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0)
+        return nullptr;
+    size = file_stat.st_size;
+    return file;
+}
+
+std::shared_ptr<OpenFile> served_file(ServedFiles &served_files, const std::string &filename, int64_t &size) {
+    ServedFiles::file served;
+    if (served_files.find(filename, served)) {
+        size = served.size;
+        return served.open;
+    }
+    uint64_t changes = served_files.changes();
+    std::shared_ptr<OpenFile> file = open_file(filename, size);
+    if (file)
+        served_files.put(filename, {file, size, 0, 0, 0, true}, changes);
+    return file;
+}
+
+// serve every thread's share of obtains into its own socket pair, drained by another thread
+double run(int threads, bool cached, int64_t file_size) {
+    ServedFiles served_files(cached ? FILES : 0);
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t]{
+            int sockets[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0)
+                exit(1);
+            std::thread drain([&]{
+                char buffer[64 * 1024];
+                while (recv(sockets[1], buffer, sizeof(buffer), 0) > 0);
+            });
+            for (int i = 0; i < SERVES; i++) {
+                int64_t size;
+                std::shared_ptr<OpenFile> file = cached ? served_file(served_files, name((i + t) % FILES), size)
+                                                        : open_file(name((i + t) % FILES), size);
+                if (file)
+                    send_file_range(sockets[0], file->fd, 0, std::min<int64_t>(size, file_size));
+            }
+            shutdown(sockets[0], SHUT_WR);
+            drain.join();
+            close(sockets[0]);
+            close(sockets[1]);
+        });
+    }
+    for (auto&& w : workers)
+        w.join();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main() {
+    mkdir(DIRECTORY, 0755);
+    mkdir(DIRECTORY "local", 0755);
+    mkdir(DIRECTORY "remote", 0755);
+    std::cout << FILES << " hot files in the remote files directory, " << SERVES << " serves per thread" << std::endl;
+    std::cout << "file size\tthreads\topen each time us/serve\tserved files us/serve\tspeedup" << std::endl;
+    for (int64_t file_size : {1024, 64 * 1024}) {
+        std::string contents(file_size, 'x');
+        for (int i = 0; i < FILES; i++) {
+            FILE *file = fopen((DIRECTORY "remote/" + name(i)).c_str(), "w");
+            fwrite(contents.data(), 1, contents.size(), file);
+            fclose(file);
+        }
+        for (int threads : {1, 4}) {
+            double opened_us = run(threads, false, file_size) * 1e6 / ((double)threads * SERVES);
+            double served_us = run(threads, true, file_size) * 1e6 / ((double)threads * SERVES);
+            std::cout << file_size << "\t\t" << threads << "\t" << opened_us << "\t\t\t" << served_us << "\t\t\t"
+                      << opened_us / served_us << std::endl;
+        }
+    }
+    for (int i = 0; i < FILES; i++)
+        remove((DIRECTORY "remote/" + name(i)).c_str());
+    rmdir(DIRECTORY "local");
+    rmdir(DIRECTORY "remote");
+    rmdir(DIRECTORY);
+    std::cout << std::endl << "opening each time makes 4 file system calls per serve (open, open, fstat, close), "
+              << "a served file none" << std::endl;
+    return 0;
+}
@@ -1,4 +1,5 @@
 from collections import defaultdict
+import os
 import sys
 
 
@@ -11,6 +12,7 @@ def get_stats(logs):
             failed = 0
             updates = 0
             invalid = 0
+            polls = 0
             for line in f.readlines():
                 if 'FAIL' in line:
                     failed += 1
@@ -34,8 +36,10 @@ def get_stats(logs):
                         downloads.remove(data[-1])
                     else:
                         invalid += 1
+                elif 'POLL' in line:
+                    polls += int(data[-1][1:-1])
         
-        consistency_percentages[node] = (requests, failed, updates, invalid)
+        consistency_percentages[node] = (requests, failed, updates, invalid, polls)
     return consistency_percentages
 
 
@@ -106,4 +110,19 @@ print 'TTR 7 sec:', pull_p_7, sum(p[3] / float(p[0]) for p in pull_p_7.values())
 print 'TTR 8 sec:', pull_p_8, sum(p[3] / float(p[0]) for p in pull_p_8.values()) / len(pull_p_8.values())
 print 'TTR 9 sec:', pull_p_9, sum(p[3] / float(p[0]) for p in pull_p_9.values()) / len(pull_p_9.values())
 print 'TTR 10 sec:', pull_p_10, sum(p[3] / float(p[0]) for p in pull_p_10.values()) / len(pull_p_10.values())
-print '-'*32
\ No newline at end of file
+print '-'*32
+
+# poll messages sent against the share of invalid reads, for the fixed ttr runs above
+# and for runs with adaptive ttrs growing up to 'ttr_max', logged under 'pull_n_adaptive/<ttr_max>/' when present
+# logs from before polls were logged show no polls
+def print_polls(name, stats):
+    print name, 'polls:', sum(p[4] for p in stats.values()) or 'not logged', 'invalid:', sum(p[3] / float(p[0]) for p in stats.values()) / len(stats.values())
+
+print 'PULL FROM NODES POLLS'
+for ttr, stats in enumerate([pull_n_1, pull_n_2, pull_n_3, pull_n_4, pull_n_5, pull_n_6, pull_n_7, pull_n_8, pull_n_9, pull_n_10]):
+    print_polls('TTR {} sec'.format(ttr + 1), stats)
+for ttr_max in range(1, 65):
+    logs = [(str(i+55000), "pull_n_adaptive/{}/55{:03d}_client.log".format(ttr_max, i)) for i in range(10, 12)]
+    if all(os.path.exists(log) for _, log in logs):
+        print_polls('TTR 1 to {} sec'.format(ttr_max), get_stats(logs))
+print '-'*32
@@ -0,0 +1,177 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol.h"
+
+
+#define COMPRESS_CHUNK_SIZE (256 * 1024) // bytes of a file compressed on their own, so any chunk can be sent or cached alone
+#define COMPRESS_SAMPLE_SIZE (16 * 1024) // bytes compressed from the start, middle and end of a file to see if it compresses
+#define COMPRESS_MIN_SIZE (4 * 1024) // smaller transfers are always sent as they are
+
+// codecs a file transfer can be sent with, accepted by a request and chosen by its reply
+enum CODECS{CODEC_NONE, CODEC_ZLIB};
+
+
+// a compressed transfer is a run of chunks, each covering COMPRESS_CHUNK_SIZE bytes of the file except the last,
+// with a header giving the size of the chunk in the file and the size sent
+// a chunk which does not get smaller is sent as it is, with both sizes the same
+
+// compress a chunk, returning false if it does not get smaller
+inline bool compress_chunk(const char *data, size_t size, int level, std::string &compressed) {
+    uLongf compressed_size = compressBound(size);
+    compressed.resize(compressed_size);
+    if (compress2((Bytef *)&compressed[0], &compressed_size, (const Bytef *)data, size, level) != Z_OK ||
+        compressed_size >= size)
+        return false;
+    compressed.resize(compressed_size);
+    return true;
+}
+
+// true if samples from the start, middle and end of a file shrink by at least a tenth at the given level
+inline bool compressible(int fd, int64_t size, int level) {
+    std::vector<char> sample(COMPRESS_SAMPLE_SIZE);
+    std::string compressed;
+    int64_t sampled = 0, compressed_total = 0;
+    for (int64_t offset : {(int64_t)0, size / 2, size - COMPRESS_SAMPLE_SIZE}) {
+        offset = std::max<int64_t>(std::min<int64_t>(offset, size - COMPRESS_SAMPLE_SIZE), 0);
+        ssize_t read_size = pread(fd, sample.data(), sample.size(), offset);
+        if (read_size <= 0)
+            return false;
+        sampled += read_size;
+        compressed_total += compress_chunk(sample.data(), read_size, level, compressed) ? compressed.size() : read_size;
+    }
+    return compressed_total * 10 < sampled * 9;
+}
+
+// compress a single chunk of a file, header included
+inline bool compress_file_chunk(int fd, int64_t offset, int64_t size, int level, std::string &chunk) {
+    std::string data(size, '\0');
+    int64_t read_size = 0;
+    ssize_t received_size;
+    while (read_size < size && (received_size = pread(fd, &data[read_size], size - read_size, offset + read_size)) > 0)
+        read_size += received_size;
+    if (read_size < size)
+        return false;
+    std::string compressed;
+    bool smaller = compress_chunk(data.data(), data.size(), level, compressed);
+    uint32_t header[2] = {htonl((uint32_t)size), htonl((uint32_t)(smaller ? compressed.size() : size))};
+    chunk.assign((const char *)header, sizeof(header));
+    chunk += smaller ? compressed : data;
+    return true;
+}
+
+// receive a compressed transfer of length bytes into a file starting at offset, or read past it if fd is negative
+// returns how many bytes of the file were written, which is less than length if the connection closed early
+inline int64_t recv_compressed(Protocol &protocol, int socket_fd, int fd, int64_t offset, int64_t length) {
+    std::string data, compressed;
+    int64_t received = 0;
+    while (received < length) {
+        uint32_t header[2];
+        if (!protocol.recv_all(socket_fd, header, sizeof(header)))
+            break;
+        uLongf size = ntohl(header[0]);
+        uint32_t sent_size = ntohl(header[1]);
+        if (size == 0 || size > COMPRESS_CHUNK_SIZE || sent_size > size || (int64_t)size > length - received)
+            break;
+        data.resize(size);
+        if (sent_size == size || fd < 0) {
+            if (!protocol.recv_all(socket_fd, &data[0], sent_size))
+                break;
+        }
+        else {
+            compressed.resize(sent_size);
+            if (!protocol.recv_all(socket_fd, &compressed[0], sent_size) ||
+                uncompress((Bytef *)&data[0], &size, (const Bytef *)compressed.data(), sent_size) != Z_OK ||
+                size != data.size())
+                break;
+        }
+        if (fd >= 0 && pwrite(fd, data.data(), size, offset + received) != (ssize_t)size)
+            break;
+        received += size;
+    }
+    return received;
+}
+
+
+// compressed chunks of the files a node server sends most, so each version of a file is only compressed once
+// entries are dropped least recently used first once they take more than the byte budget
+class CompressedFiles {
+    public:
+        typedef std::vector<std::string> chunks; // every chunk of a file in order, headers included
+
+    private:
+        struct _entry {
+            uint64_t hash; // content hash of the file the chunks were made from
+            int level;
+            std::shared_ptr<const chunks> compressed;
+            size_t bytes;
+            std::list<std::string>::iterator used; // position in the least recently used order
+        };
+
+        std::mutex _m;
+        std::unordered_map<std::string, _entry> _entries;
+        std::list<std::string> _used; // names, most recently used first
+        size_t _bytes = 0;
+        size_t _budget;
+
+        void erase(std::unordered_map<std::string, _entry>::iterator it) {
+            _bytes -= it->second.bytes;
+            _used.erase(it->second.used);
+            _entries.erase(it);
+        }
+
+    public:
+        CompressedFiles(size_t budget=0) : _budget(budget) {}
+
+        void set_budget(size_t budget) {
+            std::lock_guard<std::mutex> guard(_m);
+            _budget = budget;
+        }
+
+        size_t budget() {
+            std::lock_guard<std::mutex> guard(_m);
+            return _budget;
+        }
+
+        // chunks of the named file if they were made from the same contents at the same level, or null
+        std::shared_ptr<const chunks> find(const std::string &name, uint64_t hash, int level) {
+            std::lock_guard<std::mutex> guard(_m);
+            auto it = _entries.find(name);
+            if (it == _entries.end() || it->second.hash != hash || it->second.level != level)
+                return nullptr;
+            _used.splice(_used.begin(), _used, it->second.used);
+            return it->second.compressed;
+        }
+
+        void put(const std::string &name, uint64_t hash, int level, std::shared_ptr<const chunks> compressed) {
+            size_t bytes = 0;
+            for (auto&& chunk : *compressed)
+                bytes += chunk.size();
+            std::lock_guard<std::mutex> guard(_m);
+            auto it = _entries.find(name);
+            if (it != _entries.end())
+                erase(it);
+            if (bytes > _budget)
+                return;
+            while (_bytes + bytes > _budget)
+                erase(_entries.find(_used.back()));
+            _used.push_front(name);
+            _entries[name] = {hash, level, compressed, bytes, _used.begin()};
+            _bytes += bytes;
+        }
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol.h"
+
+
+#define HASH_BLOCK_SIZE (64 * 1024) // bytes of a file covered by each block digest
+
+
+// content hash of a whole file, combined from a digest of every block of it
+// returns 0 if the file could not be read, a readable file never hashes to 0
+// a changed file keeps its hash with a chance of about 2^-64, which is the budget invalidations and polls rely on
+// when they let a copy with the same hash stay valid
+inline uint64_t hash_file(int fd) {
+    std::vector<uint64_t> blocks;
+    std::vector<char> buffer(HASH_BLOCK_SIZE);
+    int64_t offset = 0;
+    while (1) {
+        ssize_t read_size = 0, received_size;
+        while (read_size < HASH_BLOCK_SIZE &&
+               (received_size = pread(fd, buffer.data() + read_size, HASH_BLOCK_SIZE - read_size, offset + read_size)) > 0)
+            read_size += received_size;
+        if (read_size < HASH_BLOCK_SIZE && received_size < 0)
+            return 0;
+        if (read_size == 0)
+            break;
+        blocks.push_back(range_checksum(buffer.data(), read_size));
+        offset += read_size;
+        if (read_size < HASH_BLOCK_SIZE)
+            break;
+    }
+    // the length seeds the hash, so an empty file differs from a missing one
+    uint64_t hash = range_checksum((const char *)blocks.data(), blocks.size() * sizeof(uint64_t), (uint64_t)offset);
+    return (hash != 0) ? hash : 1;
+}
+
+
+// content hashes of the files in a directory, each kept until the file's size, modification time or inode changes,
+// so a file is only read again once it may have changed
+class ContentHashes {
+    private:
+        struct _entry {
+            off_t size;
+            struct timespec modified;
+            ino_t inode;
+            uint64_t hash;
+        };
+
+        std::mutex _m;
+        std::unordered_map<std::string, _entry> _entries;
+
+        static bool same_file(const _entry &entry, const struct stat &file_stat) {
+            return entry.size == file_stat.st_size && entry.inode == file_stat.st_ino &&
+                   entry.modified.tv_sec == file_stat.st_mtim.tv_sec && entry.modified.tv_nsec == file_stat.st_mtim.tv_nsec;
+        }
+
+    public:
+        // totals for reporting how often a file had to be read
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+
+        // content hash of an open file saved under name, 0 if it could not be read
+        // the file is read without holding the lock, and a file which changed while it was read is not kept
+        uint64_t hash(const std::string &name, int fd) {
+            struct stat file_stat;
+            if (fstat(fd, &file_stat) < 0)
+                return 0;
+            {
+                std::lock_guard<std::mutex> guard(_m);
+                auto it = _entries.find(name);
+                if (it != _entries.end() && same_file(it->second, file_stat)) {
+                    hits++;
+                    return it->second.hash;
+                }
+            }
+            misses++;
+            _entry entry = {file_stat.st_size, file_stat.st_mtim, file_stat.st_ino, 0};
+            uint64_t hash = entry.hash = hash_file(fd);
+            struct stat after_stat;
+            if (hash != 0 && fstat(fd, &after_stat) == 0 && same_file(entry, after_stat)) {
+                std::lock_guard<std::mutex> guard(_m);
+                _entries[name] = entry;
+            }
+            return hash;
+        }
+
+        void remove(const std::string &name) {
+            std::lock_guard<std::mutex> guard(_m);
+            _entries.erase(name);
+        }
+};
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol.h"
+
+
+#define DELTA_MIN_BLOCK_SIZE 1024 // smallest block a copy is split into for signatures
+#define DELTA_MAX_BLOCK_SIZE (64 * 1024) // largest block, so a single changed byte never costs more than this
+#define DELTA_LITERAL_SIZE (64 * 1024) // most changed bytes sent in a single literal instruction
+#define DELTA_READ_SIZE (1024 * 1024) // bytes of the new file read at a time while looking for matching blocks
+#define DELTA_SIGNATURE_SIZE 12 // 4 byte rolling checksum followed by an 8 byte strong checksum per block
+#define DELTA_TAG_BITS 20 // bits of a rolling checksum kept in the table which rules out most windows
+
+// instructions of a delta, sent one after another after a delta reply
+#define DELTA_COPY 'C' // 4 byte first block and 4 byte block count of the old copy to copy
+#define DELTA_LITERAL 'L' // 4 byte length followed by that many bytes of the new file
+#define DELTA_END 'E'
+
+
+// rsync style delta between an old copy of a file and the current file
+// the client sends a rolling and a strong checksum of every whole block of its old copy,
+// the node server slides a window over the current file and answers with copies of blocks the client already has
+// and literal bytes for everything else, so a small edit to a large file only sends the blocks around it
+// the strong checksum is the 64 bit range_checksum, and the client still checks the rebuilt file against the
+// node's content hash, since a wrongly matched block would otherwise go unnoticed
+
+// block size giving roughly as many blocks as bytes in a block, which keeps both the signatures and the
+// literal around an edit small
+inline int delta_block_size(int64_t size) {
+    int block_size = DELTA_MIN_BLOCK_SIZE;
+    while ((int64_t)block_size * block_size < size && block_size < DELTA_MAX_BLOCK_SIZE)
+        block_size *= 2;
+    return block_size;
+}
+
+// checksum of a window which can be moved along by a byte at a time, the weak checksum of rsync
+class RollingChecksum {
+    private:
+        uint32_t _a = 0;
+        uint32_t _b = 0;
+        uint32_t _size = 0;
+
+    public:
+        void reset(const char *data, size_t size) {
+            _a = _b = 0;
+            _size = size;
+            for (size_t i = 0; i < size; i++) {
+                _a += (unsigned char)data[i];
+                _b += (size - i) * (unsigned char)data[i];
+            }
+        }
+
+        // move the window forward by one byte, dropping out and adding in
+        void roll(char out, char in) {
+            _a += (unsigned char)in - (unsigned char)out;
+            _b += _a - _size * (unsigned char)out;
+        }
+
+        uint32_t value() const {
+            return (_a & 0xffff) | (_b << 16);
+        }
+};
+
+// bits of a rolling checksum, for a table which rules out most windows without a hash lookup
+inline uint32_t delta_tag(uint32_t weak) {
+    return (weak * 2654435761U) >> (32 - DELTA_TAG_BITS);
+}
+
+// signatures of every whole block of an old copy, returning false if it could not be read
+inline bool delta_signatures(int fd, int64_t size, int block_size, std::string &signatures) {
+    signatures.clear();
+    std::vector<char> block(block_size);
+    RollingChecksum rolling;
+    for (int64_t offset = 0; offset + block_size <= size; offset += block_size) {
+        ssize_t read_size = 0, received_size;
+        while (read_size < block_size &&
+               (received_size = pread(fd, block.data() + read_size, block_size - read_size, offset + read_size)) > 0)
+            read_size += received_size;
+        if (read_size < block_size)
+            return false;
+        rolling.reset(block.data(), block_size);
+        uint32_t weak = htonl(rolling.value());
+        uint64_t strong = htobe64(range_checksum(block.data(), block_size));
+        signatures.append((const char *)&weak, sizeof(weak));
+        signatures.append((const char *)&strong, sizeof(strong));
+    }
+    return true;
+}
+
+// sends the instructions of a delta, coalescing copies of consecutive blocks and gathering literal bytes
+class DeltaWriter {
+    private:
+        Protocol &_protocol;
+        int _socket_fd;
+        std::string _literal;
+        uint32_t _copy_first = 0;
+        uint32_t _copy_count = 0;
+
+        bool send_instruction(char type, uint32_t first, uint32_t second, bool has_second) {
+            char header[9];
+            header[0] = type;
+            first = htonl(first);
+            second = htonl(second);
+            memcpy(header + 1, &first, sizeof(first));
+            memcpy(header + 5, &second, sizeof(second));
+            return _protocol.send_all(_socket_fd, header, has_second ? 9 : 5);
+        }
+
+        bool flush_copy() {
+            if (_copy_count == 0)
+                return true;
+            uint32_t count = _copy_count;
+            _copy_count = 0;
+            return send_instruction(DELTA_COPY, _copy_first, count, true);
+        }
+
+        bool flush_literal() {
+            if (_literal.empty())
+                return true;
+            bool sent = send_instruction(DELTA_LITERAL, _literal.size(), 0, false) &&
+                        _protocol.send_all(_socket_fd, _literal.data(), _literal.size());
+            _literal.clear();
+            return sent;
+        }
+
+    public:
+        int64_t literal_bytes = 0;
+
+        DeltaWriter(Protocol &protocol, int socket_fd) : _protocol(protocol), _socket_fd(socket_fd) {}
+
+        // block a copy continues from, so a run of matches stays a single copy
+        uint32_t next_block() const {
+            return _copy_first + _copy_count;
+        }
+
+        bool copy(uint32_t block) {
+            if (_copy_count > 0 && block == next_block()) {
+                _copy_count++;
+                return true;
+            }
+            if (!flush_literal() || !flush_copy())
+                return false;
+            _copy_first = block;
+            _copy_count = 1;
+            return true;
+        }
+
+        bool literal(const char *data, size_t size) {
+            if (size == 0)
+                return true;
+            if (!flush_copy())
+                return false;
+            literal_bytes += size;
+            while (size > 0) {
+                size_t taken = std::min(size, DELTA_LITERAL_SIZE - _literal.size());
+                _literal.append(data, taken);
+                data += taken;
+                size -= taken;
+                if (_literal.size() == DELTA_LITERAL_SIZE && !flush_literal())
+                    return false;
+            }
+            return true;
+        }
+
+        bool end() {
+            return flush_literal() && flush_copy() && send_instruction(DELTA_END, 0, 0, false);
+        }
+};
+
+// send the delta turning the old copy the signatures were made from into size bytes of fd
+// returns false if the connection fails or the file cannot be read
+inline bool send_delta(Protocol &protocol, int socket_fd, int fd, int64_t size, int block_size,
+                       const std::string &signatures, int64_t &literal_bytes) {
+    literal_bytes = 0;
+    if (block_size < DELTA_MIN_BLOCK_SIZE || block_size > DELTA_MAX_BLOCK_SIZE)
+        return false;
+    // blocks of the old copy by rolling checksum
+    std::unordered_map<uint32_t, std::vector<uint32_t>> blocks;
+    std::vector<uint64_t> strong_checksums;
+    std::vector<bool> tags(1 << DELTA_TAG_BITS);
+    for (size_t i = 0; i + DELTA_SIGNATURE_SIZE <= signatures.size(); i += DELTA_SIGNATURE_SIZE) {
+        uint32_t weak;
+        uint64_t strong;
+        memcpy(&weak, signatures.data() + i, sizeof(weak));
+        memcpy(&strong, signatures.data() + i + sizeof(weak), sizeof(strong));
+        weak = ntohl(weak);
+        blocks[weak].push_back(strong_checksums.size());
+        strong_checksums.push_back(be64toh(strong));
+        tags[delta_tag(weak)] = true;
+    }
+
+    DeltaWriter writer(protocol, socket_fd);
+    std::vector<char> buffer(DELTA_READ_SIZE + block_size);
+    size_t start = 0, end = 0; // window starts at start, bytes past end have not been read yet
+    size_t literal = 0; // bytes from literal up to the window matched no block
+    int64_t read_offset = 0;
+    RollingChecksum rolling;
+    bool rolled = false; // rolling holds the window at start
+    while (1) {
+        // keep at least a window and one more byte in the buffer, moving what is left to the front
+        if (end - start <= (size_t)block_size && read_offset < size) {
+            if (!writer.literal(buffer.data() + literal, start - literal))
+                return false;
+            memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = literal = 0;
+            while (end < buffer.size() && read_offset < size) {
+                ssize_t read_size = pread(fd, buffer.data() + end, std::min<int64_t>(buffer.size() - end, size - read_offset),
+                                          read_offset);
+                if (read_size <= 0)
+                    return false;
+                end += read_size;
+                read_offset += read_size;
+            }
+        }
+        if (end - start < (size_t)block_size)
+            break;
+        const char *window = buffer.data() + start;
+        if (!rolled) {
+            rolling.reset(window, block_size);
+            rolled = true;
+        }
+        uint32_t weak = rolling.value();
+        if (tags[delta_tag(weak)]) {
+            auto it = blocks.find(weak);
+            if (it != blocks.end()) {
+                uint64_t strong = range_checksum(window, block_size);
+                int64_t match = -1;
+                for (auto&& block : it->second) {
+                    // prefer the block continuing the current copy
+                    if (strong_checksums[block] == strong && (match < 0 || block == writer.next_block()))
+                        match = block;
+                }
+                if (match >= 0) {
+                    if (!writer.literal(buffer.data() + literal, start - literal) || !writer.copy(match))
+                        return false;
+                    start += block_size;
+                    literal = start;
+                    rolled = false;
+                    continue;
+                }
+            }
+        }
+        if (end - start > (size_t)block_size)
+            rolling.roll(window[0], window[block_size]);
+        else
+            rolled = false;
+        start++;
+        if (start - literal == DELTA_LITERAL_SIZE) {
+            if (!writer.literal(buffer.data() + literal, start - literal))
+                return false;
+            literal = start;
+        }
+    }
+    // the end of the file is shorter than a block
+    bool sent = writer.literal(buffer.data() + literal, end - literal) && writer.end();
+    literal_bytes = writer.literal_bytes;
+    return sent;
+}
+
+// rebuild a file into fd from the old copy in basis_fd and a delta read off the connection
+// returns the size of the rebuilt file, or -1 if the delta is cut short, malformed or cannot be written
+inline int64_t recv_delta(Protocol &protocol, int socket_fd, int basis_fd, int64_t basis_size, int block_size, int fd,
+                          int64_t &literal_bytes) {
+    std::vector<char> buffer(std::max(DELTA_LITERAL_SIZE, block_size));
+    int64_t offset = 0;
+    literal_bytes = 0;
+    while (1) {
+        char type;
+        uint32_t first, second;
+        if (!protocol.recv_all(socket_fd, &type, sizeof(type)))
+            return -1;
+        if (type == DELTA_END)
+            return offset;
+        if (!protocol.recv_all(socket_fd, &first, sizeof(first)))
+            return -1;
+        first = ntohl(first);
+        if (type == DELTA_LITERAL) {
+            if (first > buffer.size() || !protocol.recv_all(socket_fd, buffer.data(), first) ||
+                pwrite(fd, buffer.data(), first, offset) != (ssize_t)first)
+                return -1;
+            offset += first;
+            literal_bytes += first;
+            continue;
+        }
+        if (type != DELTA_COPY || !protocol.recv_all(socket_fd, &second, sizeof(second)))
+            return -1;
+        second = ntohl(second);
+        if (((int64_t)first + second) * block_size > basis_size)
+            return -1;
+        for (uint32_t block = first; block < first + second; block++) {
+            if (pread(basis_fd, buffer.data(), block_size, (int64_t)block * block_size) != block_size ||
+                pwrite(fd, buffer.data(), block_size, offset) != block_size)
+                return -1;
+            offset += block_size;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef FILES_INDEX_H
+#define FILES_INDEX_H
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <algorithm>
+
+
+#define FILES_INDEX_SHARDS 64 // number of independently locked parts of the files index
+
+
+// mapping between a filename and the ids of every node holding it
+// filenames are spread over shards with their own lock, so a search only ever waits on
+// a registration of a filename in the same shard, which holds the lock for a single map update
+class FilesIndex {
+    private:
+        struct _shard {
+            std::mutex m;
+            std::unordered_map<std::string, std::vector<int>> index;
+            std::unordered_map<int, std::unordered_set<std::string>> node_files; // filenames of this shard each node registered
+        };
+        _shard _shards[FILES_INDEX_SHARDS];
+
+        _shard &shard(const std::string &filename) {
+            return _shards[std::hash<std::string>()(filename) % FILES_INDEX_SHARDS];
+        }
+
+        static bool has_id(const std::vector<int> &ids, int id) {
+            return std::find(ids.begin(), ids.end(), id) != ids.end();
+        }
+
+        // remove id from a single filename of a locked shard, removing the filename once no ids are left
+        static void remove_from_file(_shard &s, std::unordered_map<std::string, std::vector<int>>::iterator it, int id) {
+            it->second.erase(std::remove(it->second.begin(), it->second.end(), id), it->second.end());
+            if (it->second.empty())
+                s.index.erase(it);
+        }
+
+    public:
+        // returns false if the id was already mapped to the filename
+        bool add(const std::string &filename, int id) {
+            _shard &s = shard(filename);
+            std::lock_guard<std::mutex> guard(s.m);
+            std::vector<int> &ids = s.index[filename];
+            if (has_id(ids, id))
+                return false;
+            ids.push_back(id);
+            s.node_files[id].insert(filename);
+            return true;
+        }
+
+        // remove id from a filename, removing the filename once no ids are left
+        void remove(const std::string &filename, int id) {
+            _shard &s = shard(filename);
+            std::lock_guard<std::mutex> guard(s.m);
+            auto it = s.index.find(filename);
+            if (it == s.index.end())
+                return;
+            remove_from_file(s, it, id);
+            auto node_it = s.node_files.find(id);
+            if (node_it != s.node_files.end()) {
+                node_it->second.erase(filename);
+                if (node_it->second.empty())
+                    s.node_files.erase(node_it);
+            }
+        }
+
+        // remove id from every filename, used when a node disconnects
+        // only the files the node registered are touched, one shard at a time
+        void remove_id(int id) {
+            for (auto&& s : _shards) {
+                std::lock_guard<std::mutex> guard(s.m);
+                auto node_it = s.node_files.find(id);
+                if (node_it == s.node_files.end())
+                    continue;
+                for (auto const &filename : node_it->second) {
+                    auto it = s.index.find(filename);
+                    if (it != s.index.end())
+                        remove_from_file(s, it, id);
+                }
+                s.node_files.erase(node_it);
+            }
+        }
+
+        // copy of the ids mapped to a filename, empty if the filename is not indexed
+        std::vector<int> find(const std::string &filename) {
+            _shard &s = shard(filename);
+            std::lock_guard<std::mutex> guard(s.m);
+            auto it = s.index.find(filename);
+            return (it != s.index.end()) ? it->second : std::vector<int>();
+        }
+
+        bool contains(const std::string &filename) {
+            _shard &s = shard(filename);
+            std::lock_guard<std::mutex> guard(s.m);
+            return s.index.find(filename) != s.index.end();
+        }
+
+        bool contains(const std::string &filename, int id) {
+            _shard &s = shard(filename);
+            std::lock_guard<std::mutex> guard(s.m);
+            auto it = s.index.find(filename);
+            return it != s.index.end() && has_id(it->second, id);
+        }
+
+        // visit every filename and its ids, holding one shard's lock at a time
+        void for_each(std::function<void(const std::string &, const std::vector<int> &)> f) {
+            for (auto&& s : _shards) {
+                std::lock_guard<std::mutex> guard(s.m);
+                for (auto const &file_index : s.index)
+                    f(file_index.first, file_index.second);
+            }
+        }
+};
+
+#endif
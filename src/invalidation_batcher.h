@@ -0,0 +1,76 @@
+#ifndef INVALIDATION_BATCHER_H
+#define INVALIDATION_BATCHER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "protocol.h"
+
+
+#define INVALIDATION_WINDOW 100 // milliseconds invalidations are gathered for before being sent
+
+
+// invalidations waiting to be sent, gathered per destination
+// a destination only ever gets the newest version of a file, older versions still waiting are dropped
+class InvalidationBatcher {
+    public:
+        struct pending {
+            message msg;
+            uint64_t queued; // when the oldest invalidation this entry covers was added, in milliseconds
+        };
+
+    private:
+        std::mutex _m;
+        // destination, then origin node and filename of every waiting invalidation
+        std::unordered_map<int, std::map<std::pair<int, std::string>, pending>> _pending;
+
+    public:
+        // totals for reporting how much the batching saves
+        std::atomic<uint64_t> added{0};
+        std::atomic<uint64_t> superseded{0};
+
+        static uint64_t milliseconds_now() {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        void add(int destination, const message &msg, uint64_t now=milliseconds_now()) {
+            std::lock_guard<std::mutex> guard(_m);
+            added++;
+            auto inserted = _pending[destination].insert({{msg.id, msg.filename}, {msg, now}});
+            if (inserted.second)
+                return;
+            // keep the newest version, but it has been waiting since the first one was added
+            // a later edit within the same second keeps its version but carries a new hash, so it replaces the older one too
+            superseded++;
+            pending &p = inserted.first->second;
+            if (msg.version >= p.msg.version)
+                p.msg = msg;
+        }
+
+        // hand over everything waiting, grouped by destination
+        std::unordered_map<int, std::vector<pending>> take() {
+            std::unordered_map<int, std::map<std::pair<int, std::string>, pending>> waiting;
+            {
+                std::lock_guard<std::mutex> guard(_m);
+                waiting.swap(_pending);
+            }
+            std::unordered_map<int, std::vector<pending>> batches;
+            for (auto&& x : waiting) {
+                std::vector<pending> &batch = batches[x.first];
+                for (auto&& file : x.second)
+                    batch.push_back(file.second);
+            }
+            return batches;
+        }
+};
+
+#endif
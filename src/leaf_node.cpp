@@ -7,21 +7,40 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/sendfile.h>
+#include <sys/inotify.h>
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include <iostream>
 #include <sstream>
 #include <vector>
 #include <algorithm>
 #include <chrono>
 #include <fstream>
-
+#include <set>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+
+#include "protocol.h"
+#include "logger.h"
+#include "remote_files.h"
+#include "transfer.h"
+#include "content_hash.h"
+#include "delta.h"
+#include "compression.h"
+#include "served_files.h"
 
 #define HOST "localhost" // assume all connections happen on same machine
-#define MAX_FILENAME_SIZE 256 // assume the maximum file size is 256 characters
-#define MAX_MSG_SIZE 4096
-#define MAX_STAT_MSG_SIZE 16
+#define REGISTRATION_INTERVAL 5 // seconds between registration updates sent to the peer
+#define LOCAL_RESCAN_INTERVAL 60 // seconds between full rescans of the local files directory while it is being watched
+#define SWARM_CHUNK_SIZE (1024 * 1024) // bytes of a file requested from a single node at a time when swarming
+#define SWARM_MAX_SOURCES 8 // most nodes a single file is downloaded from at once
+#define SWARM_RETRIES 3 // failed requests a chunk, or a node, is allowed before it is given up on
+#define PIPELINE_DEPTH 16 // requests sent ahead of their replies on a session, few enough to always fit the socket buffers
+#define TTR_GROWTH 2 // factor the ttr of a cached copy grows by each time a poll finds it unchanged
 
 
 enum CONSISTENCY_METHODS{PUSH, PULL_N, PULL_P}; // cleaner comparisons for consistency method in use
@@ -29,290 +48,384 @@ enum CONSISTENCY_METHODS{PUSH, PULL_N, PULL_P}; // cleaner comparisons for consi
 
 class LeafNode {
     private:
-        std::vector<std::pair<std::string, time_t>> _local_files; // vector of all local files within a node's directory
-        
-        struct _remote_file {
-            std::string local_name; // name of the saved file in the current node's directory
-            std::string origin_name; // name of the file from the origin server
-            int origin_node; // the origin server's id
-            time_t version; // version number of the remote file
-            std::chrono::time_point<std::chrono::system_clock> check_time; // last time the file's consistency was checked
-            bool valid; // flag for if a file is valid (consistent) or has been removed
+        // a local file's version only changes when its contents do, so rewriting or touching it is not a modification
+        struct _local_file {
+            time_t version;
+            uint64_t hash; // content hash, 0 if the file could not be read
         };
-        std::vector<_remote_file> _remote_files; // vector of all remote files within a node's directory
-        std::ofstream _server_log;
-        std::ofstream _client_log;
-
-        std::mutex _log_m;
-        std::mutex _remote_files_m;
-
-        // helper function for getting the current time to microsecond-accuracy as a string
-        std::string time_now() {
-            std::chrono::high_resolution_clock::duration now = std::chrono::high_resolution_clock::now().time_since_epoch();
-            std::chrono::microseconds now_ms = std::chrono::duration_cast<std::chrono::microseconds>(now);
-            return std::to_string(now_ms.count());
-        }
+        std::unordered_map<std::string, _local_file> _local_files; // name, version and hash of all local files within a node's directory
+        std::mutex _local_files_m;
+        ContentHashes _content_hashes; // hashes of the local files, only read again once a file changes
+        int _compression_level = 0; // zlib level transfers are compressed with, 0 if they are sent as they are
+        CompressedFiles _compressed_files; // compressed chunks of the files sent most, by name
+        ServedFiles _served_files; // open files recently sent by the node server, by name
+
+        int _inotify_fd = -1; // watches the local files directory, -1 if changes are only found by rescanning it
+        std::atomic<bool> _watching{false};
+        std::atomic<bool> _rescan{false}; // set when the watcher may have missed changes
+        // wakes the registration thread as soon as a local file changes
+        std::mutex _files_changed_m;
+        std::condition_variable _files_changed_cv;
+        bool _files_changed = false;
+
+        RemoteFiles _remote_files; // all remote files within a node's directory
+        std::unordered_map<std::string, std::string> _options; // optional 'key value' settings from the config file
+        Protocol _protocol; // encodes every message sent or received in the configured wire format
+
+        Logger _logger;
+        int _server_log = -1; // sink of the node server's log file
+        int _client_log = -1; // sink of the node client's log file
+
+        std::mutex _peer_m; // held over every request and its reply on the connection to the peer
+        uint32_t _registration_id = 0; // id of the last registration batch sent to the peer
 
         // log message to specified log file
-        void log(std::ofstream &log_stream, std::string type, std::string msg) {
-            std::lock_guard<std::mutex> guard(_log_m);
-            log_stream << '[' << time_now() << "] [" << type << "] " << msg  << '\n' << std::endl;
+        void log(int sink, const std::string &type, const std::string &msg, int level=LOG_INFO) {
+            _logger.write(sink, level, type, msg);
         }
 
         //special log messages used for later analysis
-        void eval_log(std::ofstream &log_stream, std::string type, std::string msg) {
-            std::lock_guard<std::mutex> guard(_log_m);
-            log_stream << '!' << " [" << type << "] [" << msg  << "]\n" << std::endl;
+        void eval_log(int sink, const std::string &type, const std::string &msg) {
+            _logger.write(sink, LOG_EVAL, type, msg);
         }
         
         void error(std::string type) {
+            _logger.stop();
             std::cerr << "\n[" << type << "] exiting program\n" << std::endl;
             exit(1);
         }
 
         // handle all requests sent to the node
         void handle_connection(int socket_fd) {
-            char request;
+            message msg;
             //initialize connection by getting request type
-            if (recv(socket_fd, &request, sizeof(request), 0) < 0) {
-                log(_server_log, "conn unidentified", "closing connection");
+            if (_protocol.recv_message(socket_fd, LEAF_NODE_CONNECTION, msg) != MSG_OK) {
+                log(_server_log, "conn unidentified", "closing connection", LOG_WARNING);
                 close(socket_fd);
                 return;
             }
 
-            switch (request) {
-                case '0':
-                    handle_peer_request(socket_fd);
-                    break;
-                case '1':
-                    handle_node_request(socket_fd);
-                    break;
-                default:
-                    log(_server_log, "conn unidentified", "closing connection");
-                    close(socket_fd);
-                    return;
-            }
-        }
-
-        // handle invalidation request from peer
-        void handle_peer_request(int socket_fd) {
-            int id;
-            // get the id of the file to compare
-            if (recv(socket_fd, &id, sizeof(id), 0) < 0)
-                log(_server_log, "peer unresponsive", "ignoring request");
-            else {
-                // get the filename of the file to compare
-                char buffer[MAX_FILENAME_SIZE];
-                if (recv(socket_fd, buffer, sizeof(buffer), 0) < 0)
-                    log(_server_log, "peer unresponsive", "ignoring request");
-                else {
-                    // get the version of the file to compare
-                    time_t version;
-                    if (recv(socket_fd, &version, sizeof(version), 0) < 0)
-                        log(_server_log, "peer unresponsive", "ignoring request");
-                    else {
-                        // iterator to find remote file from recvd attributes
-                        auto it = std::find_if(_remote_files.begin(), _remote_files.end(),
-                                      [id, buffer, version](const _remote_file &e) {
-                                          return e.origin_node == id && e.origin_name == buffer && e.version != version;
-                                      });
-                        // mark file invalid and remove from remote files directory if the node owns the file
-                        if(it != _remote_files.end()) {
-                            it->valid = false;
-                            std::string filename_path = _remote_files_path + it->local_name;
-                            remove(filename_path.c_str());
-                            std::string msg = "remote file \"" + it->local_name + "\" modified";
-                            log(_client_log, "removing file", msg);
-                            eval_log(_client_log, "RMV", std::to_string(it->origin_node) + '/' + it->origin_name);
-                        }
-                    }
-                }
+            if (msg.type == LEAF_SESSION) {
+                // a session carries requests one after another, each answered in order, until the client closes it
+                int status;
+                while ((status = _protocol.recv_message(socket_fd, LEAF_NODE_CONNECTION, msg)) == MSG_OK &&
+                       handle_request(socket_fd, msg));
+                if (status == MSG_ERROR)
+                    log(_server_log, "malformed request", "closing session", LOG_WARNING);
             }
+            else
+                handle_request(socket_fd, msg);
             close(socket_fd);
+            log(_server_log, "client disconnected", "closed connection", LOG_DEBUG);
         }
 
-        // handle requests from other nodes
-        void handle_node_request(int socket_fd) {
-            char request;
-            // get request type from node
-            if (recv(socket_fd, &request, sizeof(request), 0) < 0) {
-                log(_server_log, "client unresponsive", "closing connection");
-                close(socket_fd);
-                return;
+        // handle a single request, returning false if the connection can no longer carry another one
+        bool handle_request(int socket_fd, message &msg) {
+            switch (msg.type) {
+                case NODE_INVALIDATE:
+                    invalidate_remote_file(msg);
+                    return true;
+                case NODE_INVALIDATE_BATCH:
+                    handle_peer_batch(msg);
+                    return true;
+                case OBTAIN:
+                case OBTAIN_PART:
+                case OBTAIN_DELTA:
+                    return handle_obtain_request(socket_fd, msg);
+                case POLL:
+                    return handle_poll_request(socket_fd, msg);
+                case OBTAIN_RANGE:
+                    return handle_obtain_range(socket_fd, msg);
             }
+            return false;
+        }
 
-            switch (request) {
-                case '1':
-                    handle_obtain_request(socket_fd);
-                    break;
-                case '2':
-                    handle_poll_request(socket_fd);
-                    break;
-                default:
-                    log(_server_log, "client unresponsive", "closing connection");
-                    close(socket_fd);
-                    return;
+        // handle every invalidation of a batch sent by the peer
+        void handle_peer_batch(message &msg) {
+            std::vector<message> invalidations;
+            if (!_protocol.decode_batch(msg.text, invalidations))
+                log(_server_log, "malformed batch", "ignoring request", LOG_WARNING);
+            for (auto&& invalidation : invalidations) {
+                if (invalidation.type == NODE_INVALIDATE)
+                    invalidate_remote_file(invalidation);
             }
         }
 
-        // handles a node server's file retrieval request
-        // only performs single retrieval
-        void handle_obtain_request(int socket_fd) {
-            // recieve filename to download from node client
-            char buffer[MAX_FILENAME_SIZE];
-            if (recv(socket_fd, buffer, MAX_FILENAME_SIZE, 0) < 0) {
-                log(_server_log, "client unresponsive", "closing connection");
-                close(socket_fd);
-                return;
-            }
+        // drop a cached copy of a file if the origin node's contents are different
+        // copies are compared by version when either side has no content hash
+        void invalidate_remote_file(message &msg) {
+            time_t version = msg.version;
+            uint64_t hash = msg.hash;
+            RemoteFiles::file invalidated;
+            // mark file invalid and remove from remote files directory if the node owns the file
+            if (_remote_files.invalidate(msg.id, msg.filename, [version, hash](const RemoteFiles::file &cached) {
+                    return (hash != 0 && cached.hash != 0) ? cached.hash != hash : cached.version != version;
+                }, invalidated))
+                remove_remote_file(invalidated);
+        }
 
-            // create full file path of node server to send
-            std::string filename = _local_files_path + buffer;
+        // remove an invalidated copy from the remote files directory
+        // it is kept aside as a stale copy, so refreshing the file only needs the blocks which changed,
+        // which still counts against the remote files budget until it is used up or evicted
+        void remove_remote_file(const RemoteFiles::file &remote_file) {
+            std::string filename_path = _remote_files_path + remote_file.local_name;
+            _served_files.remove(remote_file.local_name);
+            if (rename(filename_path.c_str(), (filename_path + ".stale").c_str()) < 0)
+                remove(filename_path.c_str());
+            else
+                _remote_files.keep_leftover(remote_file.local_name + ".stale", remote_file.size);
+            std::string log_msg = "remote file \"" + remote_file.local_name + "\" modified";
+            log(_client_log, "removing file", log_msg);
+            eval_log(_client_log, "RMV", std::to_string(remote_file.origin_node) + '/' + remote_file.origin_name);
+        }
 
+        // open a file the node can share, from the local files directory or else the remote files directory
+        // sets the size, origin node and version of the reply, or a negative size and returns null if it cannot be read
+        // a file served recently is taken from the served files without touching the file system
+        std::shared_ptr<OpenFile> open_shared_file(const std::string &name, message &reply) {
+            ServedFiles::file served;
+            if (_served_files.find(name, served)) {
+                reply.size = served.size;
+                reply.id = served.origin;
+                reply.version = served.version;
+                reply.hash = served.hash;
+                // keeps the cached copy recently used in the remote files directory
+                RemoteFiles::file remote_file;
+                if (served.remote)
+                    _remote_files.serve_local(name, remote_file);
+                return served.open;
+            }
+            uint64_t changes = _served_files.changes();
+            std::string filename = _local_files_path + name;
             int fd = open(filename.c_str(), O_RDONLY);
             bool from_remote = false;
             // assume if invalid fd then file does not exist in node's local files directory
             if (fd == -1) {
-                close(fd);
                 // check if file exists in node's remote files directory
-                filename = _remote_files_path + buffer;
+                filename = _remote_files_path + name;
                 fd = open(filename.c_str(), O_RDONLY);
                 from_remote = true;
             }
+            struct stat file_stat;
             if (fd == -1) {
-                // send message to node client if file cannot be opened
-                if (send(socket_fd, "-1", MAX_STAT_MSG_SIZE, 0) < 0)
-                    log(_server_log, "client unresponsive", "closing connection");
+                reply.size = -1;
+                return nullptr;
             }
-            else {
-                struct stat file_stat;
-                if (fstat(fd, &file_stat) < 0) {
-                    // send message to node client if file size cannot be determined
-                    if (send(socket_fd, "-2", MAX_STAT_MSG_SIZE, 0) < 0)
-                        log(_server_log, "client unresponsive", "closing connection");
+            auto open_file = std::make_shared<OpenFile>(fd);
+            if (fstat(fd, &file_stat) < 0) {
+                // file size cannot be determined
+                reply.size = -2;
+                return nullptr;
+            }
+            reply.size = file_stat.st_size;
+            reply.version = -1;
+            reply.id = _port;
+            if (from_remote) {
+                // get file attributes for the cached copy saved under the name, a file which is not one is never kept open
+                RemoteFiles::file remote_file;
+                if (_remote_files.serve_local(name, remote_file)) {
+                    reply.version = remote_file.version;
+                    reply.id = remote_file.origin_node;
+                    reply.hash = remote_file.hash;
+                    _served_files.put(name, {open_file, reply.size, reply.id, reply.version, reply.hash, true}, changes);
                 }
-                else {
-                    char file_size[MAX_STAT_MSG_SIZE];
-                    sprintf(file_size, "%ld", file_stat.st_size);
+            }
+            else {
+                // get version of file stored in local files directory, the hash is of the file being sent
+                reply.hash = _content_hashes.hash(name, fd);
+                std::lock_guard<std::mutex> guard(_local_files_m);
+                auto it = _local_files.find(name);
+                if (it != _local_files.end())
+                    reply.version = it->second.version;
+                // without the watcher nothing would tell the served files a local file changed
+                if (_watching)
+                    _served_files.put(name, {open_file, reply.size, reply.id, reply.version, reply.hash, false}, changes);
+            }
+            return open_file;
+        }
 
-                    //send file size to node client
-                    if (send(socket_fd, file_size, sizeof(file_size), 0) < 0) {
-                        log(_server_log, "client unresponsive", "closing connection");
-                        close(fd);
-                        close(socket_fd);
-                        return;
-                    }
+        // handles a node server's file retrieval request
+        // only performs single retrieval, of the whole file, of the part a client is missing,
+        // or of the changes to a client's old copy
+        bool handle_obtain_request(int socket_fd, message &msg) {
+            message reply;
+            reply.type = (msg.type == OBTAIN_PART) ? OBTAIN_PART_REPLY :
+                         (msg.type == OBTAIN_DELTA) ? OBTAIN_DELTA_REPLY : OBTAIN_REPLY;
+            std::shared_ptr<OpenFile> file = open_shared_file(msg.filename, reply);
+            int fd = file ? file->fd : -1;
+            int64_t length = reply.size;
+            std::shared_ptr<const CompressedFiles::chunks> cached;
+            if (fd != -1 && msg.type == OBTAIN_PART) {
+                // a part only continues a copy of the same file and version, anything else is sent from the start
+                if (msg.id == reply.id && msg.version == reply.version && msg.offset >= 0 && msg.offset <= reply.size)
+                    reply.offset = msg.offset;
+                length = std::min<int64_t>(msg.size, reply.size - reply.offset);
+                // the rest of a file is compressed if the client accepts it and a sample of the file shrinks,
+                // starting from the chunk the client's part ends in
+                if (msg.codec == CODEC_ZLIB && _compression_level > 0 && length == reply.size - reply.offset &&
+                    length >= COMPRESS_MIN_SIZE &&
+                    ((cached = _compressed_files.find(msg.filename, reply.hash, _compression_level)) ||
+                     compressible(fd, reply.size, _compression_level))) {
+                    reply.codec = CODEC_ZLIB;
+                    reply.offset -= reply.offset % COMPRESS_CHUNK_SIZE;
+                    length = reply.size - reply.offset;
+                }
+            }
 
-                    time_t version = -1;
-                    int id = _port;
-                    if (from_remote) {
-                        // get file attributes for cached version of a file
-                        // assume the first name to match is the one to download
-                        auto it = std::find_if(_remote_files.begin(), _remote_files.end(),
-                                    [buffer](const _remote_file &e){
-                                        return e.origin_name == buffer;
-                                    });
-                        if(it != _remote_files.end()) {
-                            version = it->version;
-                            id = it->origin_node;
-                        }
-                    }
-                    else {
-                        // get version of file stored in local files directory
-                        auto it = std::find_if(_local_files.begin(), _local_files.end(),
-                                    [buffer](const std::pair<std::string, time_t> &e){
-                                        return e.first == buffer;
-                                    });
-                        if(it != _local_files.end())
-                            version = it->second;
-                    }
-                    
-                    // send origin node of file
-                    if (send(socket_fd, &id, sizeof(id), 0) < 0) {
-                        log(_server_log, "client unresponsive", "closing connection");
-                        close(fd);
-                        close(socket_fd);
-                        return;
-                    }
-                    // send version of file
-                    if (send(socket_fd, &version, sizeof(version), 0) < 0) {
-                        log(_server_log, "client unresponsive", "closing connection");
-                        close(fd);
-                        close(socket_fd);
-                        return;
-                    }
+            // a rebuilt delta is always checked against the content hash, so a cached copy without one is hashed here
+            if (fd != -1 && msg.type == OBTAIN_DELTA && reply.hash == 0)
+                reply.hash = hash_file(fd);
+
+            // send file size, origin node and version of file ahead of the file itself, or a negative size if it cannot be read
+            bool sent = _protocol.send_message(socket_fd, reply);
+            int64_t literal_bytes;
+            if (!sent)
+                log(_server_log, "client unresponsive", "closing connection", LOG_WARNING);
+            else if (fd != -1 && msg.type == OBTAIN_DELTA) {
+                if ((sent = send_delta(_protocol, socket_fd, fd, reply.size, msg.size, msg.text, literal_bytes)))
+                    log(_server_log, "delta sent", std::to_string(literal_bytes) + " of " + std::to_string(reply.size) +
+                                                   " bytes of \"" + msg.filename + "\" changed", LOG_DEBUG);
+                else
+                    log(_server_log, "client unresponsive", "delta cut short", LOG_WARNING);
+            }
+            else if (fd != -1 && reply.codec == CODEC_ZLIB) {
+                if (!(sent = send_compressed(socket_fd, fd, msg.filename, reply, cached)))
+                    log(_server_log, "client unresponsive", "file transfer cut short", LOG_WARNING);
+            }
+            else if (fd != -1 && !(sent = send_file_range(socket_fd, fd, reply.offset, length)))
+                log(_server_log, "client unresponsive", "file transfer cut short", LOG_WARNING);
+            return sent;
+        }
 
-                    off_t offset = 0;
-                    int remaining_size = file_stat.st_size;
-                    int sent_size = 0;
-                    //send file in 4096 byte blocks until entire file sent
-                    while (((sent_size = sendfile(socket_fd, fd, &offset, MAX_MSG_SIZE)) > 0) && (remaining_size > 0))
-                        remaining_size -= sent_size;
+        // send a file from the offset of its reply to its end as compressed chunks, taken from cached if it is not null
+        // a whole file compressed here is kept for the next client as long as it fits the cache
+        bool send_compressed(int socket_fd, int fd, const std::string &filename, const message &reply,
+                             std::shared_ptr<const CompressedFiles::chunks> cached) {
+            size_t first = reply.offset / COMPRESS_CHUNK_SIZE;
+            int64_t sent_size = 0;
+            if (cached) {
+                for (size_t i = first; i < cached->size(); i++) {
+                    if (!_protocol.send_all(socket_fd, (*cached)[i].data(), (*cached)[i].size()))
+                        return false;
+                    sent_size += (*cached)[i].size();
                 }
             }
-            close(fd);
-            close(socket_fd);
-            log(_server_log, "client disconnected", "closed connection");
+            else {
+                auto chunks = std::make_shared<CompressedFiles::chunks>();
+                bool keep = first == 0 && reply.hash != 0;
+                size_t budget = _compressed_files.budget();
+                std::string chunk;
+                for (int64_t offset = reply.offset; offset < reply.size; offset += COMPRESS_CHUNK_SIZE) {
+                    int64_t size = std::min<int64_t>(COMPRESS_CHUNK_SIZE, reply.size - offset);
+                    if (!compress_file_chunk(fd, offset, size, _compression_level, chunk) ||
+                        !_protocol.send_all(socket_fd, chunk.data(), chunk.size()))
+                        return false;
+                    sent_size += chunk.size();
+                    keep = keep && (size_t)sent_size <= budget;
+                    if (keep)
+                        chunks->push_back(chunk);
+                }
+                if (keep)
+                    _compressed_files.put(filename, reply.hash, _compression_level, chunks);
+            }
+            log(_server_log, "compressed transfer", std::to_string(sent_size) + " bytes sent for " +
+                std::to_string(reply.size - reply.offset) + " bytes of \"" + filename + "\"" + (cached ? " from cache" : ""), LOG_DEBUG);
+            return true;
+        }
+
+        // handles a request for a single byte range of a file from a client downloading it from several nodes
+        // the range is read into memory first so its checksum can be sent ahead of it
+        bool handle_obtain_range(int socket_fd, message &msg) {
+            message reply;
+            reply.type = OBTAIN_RANGE_REPLY;
+            std::shared_ptr<OpenFile> file = open_shared_file(msg.filename, reply);
+            std::string data;
+            if (file) {
+                int fd = file->fd;
+                // anything past the end of the file is left out of the range
+                int64_t length = std::min<int64_t>(std::min<int64_t>(msg.size, reply.size - msg.offset), MAX_RANGE_SIZE);
+                if (msg.offset < 0 || length < 0)
+                    length = 0;
+                data.resize(length);
+                int64_t read_size = 0;
+                ssize_t received_size;
+                while (read_size < length &&
+                       (received_size = pread(fd, &data[read_size], length - read_size, msg.offset + read_size)) > 0)
+                    read_size += received_size;
+                if (read_size < length)
+                    reply.size = -2;
+                // seeded with the offset, so bytes from another part of the file do not pass for the range
+                reply.checksum = range_checksum(data.data(), data.size(), msg.offset);
+            }
+            if (!_protocol.send_message(socket_fd, reply) ||
+                (reply.size >= 0 && !_protocol.send_all(socket_fd, data.data(), data.size()))) {
+                log(_server_log, "client unresponsive", "closing connection", LOG_WARNING);
+                return false;
+            }
+            return true;
         }
 
         // check other node's cached file with local version of file
-        void handle_poll_request(int socket_fd) {
-            // get filename of file to check
-            char buffer[MAX_FILENAME_SIZE];
-            if (recv(socket_fd, buffer, sizeof(buffer), 0) < 0)
-                log(_server_log, "node unresponsive", "ignoring request");
-            else {
-                // get version of file to check
-                time_t version;
-                if (recv(socket_fd, &version, sizeof(version), 0) < 0)
-                    log(_server_log, "node unresponsive", "ignoring request");
-                else {
-                    std::pair<std::string, time_t> file_info = {buffer, version};
-                    // send validity of file (based on if file exists in local directory and the version matches)
-                    bool valid = std::find(_local_files.begin(), _local_files.end(), file_info) != _local_files.end();
-                    if (send(socket_fd, &valid, sizeof(valid), 0) < 0) {
-                        log(_server_log, "node unresponsive", "ignoring request"); 
-                    }
-                }
+        bool handle_poll_request(int socket_fd, message &msg) {
+            message reply;
+            reply.type = POLL_REPLY;
+            // send validity of file (based on if file exists in local directory and the contents, or else the version, match)
+            {
+                std::lock_guard<std::mutex> guard(_local_files_m);
+                auto it = _local_files.find(msg.filename);
+                if (it != _local_files.end() && msg.hash != 0 && it->second.hash != 0)
+                    reply.valid = it->second.hash == msg.hash;
+                else
+                    reply.valid = it != _local_files.end() && it->second.version == msg.version;
             }
-            close(socket_fd);
+            if (!_protocol.send_message(socket_fd, reply)) {
+                log(_server_log, "node unresponsive", "ignoring request", LOG_WARNING);
+                return false;
+            }
+            return true;
+        }
+
+        // gets the modified time and content hash of a file in the local files directory,
+        // returning false if it is not a readable file
+        bool scan_local_file(const std::string &name, _local_file &file) {
+            struct stat file_stat;
+            std::string file_path = _local_files_path + name;
+            if (stat(file_path.c_str(), &file_stat) < 0 || !S_ISREG(file_stat.st_mode))
+                return false;
+            int fd = open(file_path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                //ignore file if unable to open
+                log(_client_log, "failed file open", "ignoring \"" + file_path + '\"', LOG_WARNING);
+                return false;
+            }
+            file.version = file_stat.st_mtim.tv_sec;
+            file.hash = _content_hashes.hash(name, fd);
+            close(fd);
+            return true;
+        }
+
+        // a file whose contents have not changed keeps the version it already has
+        static void keep_version(const std::unordered_map<std::string, _local_file> &files, const std::string &name,
+                                 _local_file &file) {
+            auto it = files.find(name);
+            if (it != files.end() && file.hash != 0 && it->second.hash == file.hash)
+                file.version = it->second.version;
         }
 
         // read all files in node's directory and save to files vector
-        std::vector<std::pair<std::string, time_t>> get_files() {
-            std::vector<std::pair<std::string, time_t>> tmp_files;
+        std::unordered_map<std::string, _local_file> get_files() {
+            std::unordered_map<std::string, _local_file> tmp_files;
             
             if (auto directory = opendir(_local_files_path.c_str())) {
                 while (auto file = readdir(directory)) {
                     //skip . and .. files and any directories
-                    if (!file->d_name || strcmp(file->d_name, ".") == 0 || strcmp(file->d_name, "..") == 0 || file->d_type == DT_DIR)
-                        continue;
-                    
-                    // get full file path
-                    std::ostringstream file_path;
-                    file_path << _local_files_path;
-                    file_path << file->d_name;
-                    
-                    int fd = open(file_path.str().c_str(), O_RDONLY);
-                    if (fd == -1) {
-                        //ignore file if unable to open
-                        log(_client_log, "failed file open", "ignoring \"" + file_path.str() + '\"');
-                        continue;
-                    }
-                    
-                    struct stat file_stat;
-                    if (fstat(fd, &file_stat) < 0) {
-                        // ignore file if unable to file stats
-                        log(_client_log, "failed file stat", "ignoring \"" + file_path.str() + '\"');
+                    if (strcmp(file->d_name, ".") == 0 || strcmp(file->d_name, "..") == 0 || file->d_type == DT_DIR)
                         continue;
-                    }
-                    close(fd);
 
-                    // save a pair of the filename and last modified date to the files vector if not already in there
-                    time_t modified_time = file_stat.st_mtim.tv_sec;
-                    std::pair<std::string, time_t> file_info = std::make_pair(file->d_name, modified_time);
-                    if(!(std::find(tmp_files.begin(), tmp_files.end(), file_info) != tmp_files.end()))
-                        tmp_files.push_back(file_info);
+                    // save the filename with its last modified date and hash, every name in a directory is unique
+                    _local_file local_file;
+                    if (scan_local_file(file->d_name, local_file))
+                        tmp_files[file->d_name] = local_file;
                 }
                 closedir(directory);
             }
@@ -322,6 +435,68 @@ class LeafNode {
             return tmp_files;
         }
 
+        // update a single local file after a change, removing it if it is gone
+        void update_local_file(const std::string &name) {
+            _local_file file;
+            bool exists = scan_local_file(name, file);
+            if (!exists)
+                _content_hashes.remove(name);
+            std::lock_guard<std::mutex> guard(_local_files_m);
+            if (exists) {
+                keep_version(_local_files, name, file);
+                _local_files[name] = file;
+            }
+            else
+                _local_files.erase(name);
+        }
+
+        // thread keeping the local files up to date from inotify events, so changes are registered as soon as they happen
+        void watch_local_files() {
+            char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            while (1) {
+                ssize_t length = read(_inotify_fd, buffer, sizeof(buffer));
+                if (length < 0 && errno == EINTR)
+                    continue;
+                if (length <= 0) {
+                    log(_client_log, "failed file watch", "rescanning local files every cycle", LOG_WARNING);
+                    _watching = false;
+                    return;
+                }
+                bool changed = false;
+                for (char *p = buffer; p < buffer + length;) {
+                    struct inotify_event *event = (struct inotify_event *)p;
+                    p += sizeof(struct inotify_event) + event->len;
+                    // the kernel dropped events or stopped watching the directory, only a rescan can catch up
+                    if (event->mask & IN_Q_OVERFLOW)
+                        _rescan = changed = true;
+                    if (event->mask & IN_IGNORED) {
+                        log(_client_log, "failed file watch", "rescanning local files every cycle", LOG_WARNING);
+                        _watching = false;
+                        changed = true;
+                    }
+                    if (event->len > 0 && !(event->mask & IN_ISDIR)) {
+                        // an open copy is not served again once the file is written to, before the write is even finished,
+                        // nor one opened before its new version was recorded
+                        _served_files.remove(event->name);
+                        if (event->mask != IN_MODIFY) {
+                            update_local_file(event->name);
+                            _served_files.remove(event->name);
+                            changed = true;
+                        }
+                    }
+                }
+                if (changed) {
+                    {
+                        std::lock_guard<std::mutex> guard(_files_changed_m);
+                        _files_changed = true;
+                    }
+                    _files_changed_cv.notify_one();
+                }
+                if (!_watching)
+                    return;
+            }
+        }
+
         // create a connection to some server given a specific port
         // peer flag used for knowing which type of server to connect
         int connect_server(int port, bool peer=true) {
@@ -330,11 +505,16 @@ class LeafNode {
             bzero((char *)&addr, addr_size);
 
             // open a socket for the new connection
-            struct hostent *server = gethostbyname(HOST);
+            {
+                // gethostbyname shares its result between threads, and swarming downloads connect from several at once
+                static std::mutex host_m;
+                std::lock_guard<std::mutex> guard(host_m);
+                struct hostent *server = gethostbyname(HOST);
+                bcopy((char *)server->h_addr, (char *)&addr.sin_addr.s_addr, server->h_length);
+            }
             int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
 
             addr.sin_family = AF_INET;
-            bcopy((char *)server->h_addr, (char *)&addr.sin_addr.s_addr, server->h_length);
             addr.sin_port = htons(port);
             
             // connect to the server
@@ -343,6 +523,7 @@ class LeafNode {
                 if (peer)
                     error("failed peer connection");
                 else {
+                    close(socket_fd);
                     return -1;
                 }
             }
@@ -350,181 +531,264 @@ class LeafNode {
             return socket_fd;
         }
 
-        void register_files(int socket_fd) {
-            int n;
-            char buffer[MAX_FILENAME_SIZE];
+        // build a registry or deregistry message for a single file
+        // cached copies of remote files are registered with the id of their origin node
+        // the legacy wire format has no subscriptions, so cached copies are registered as plain files there,
+        // and deregistered with version -1 so the peer does not take it for a modified file
+        message registration(int type, std::string filename, time_t version, int origin=0) {
+            if (_protocol.wire_format == LEGACY && type == REMOTE_REGISTRY)
+                type = REGISTRY;
+            else if (_protocol.wire_format == LEGACY && type == REMOTE_DEREGISTRY) {
+                type = DEREGISTRY;
+                version = -1;
+            }
+            message msg;
+            msg.type = type;
+            msg.id = origin;
+            msg.filename = filename;
+            msg.version = version;
+            return msg;
+        }
 
-            while (1) {
-                // reigister files from local files directory
-                std::vector<std::pair<std::string, time_t>> tmp_files = get_files();
-                for (auto&& x: _local_files) {
-                    char request = '1';
-                    // check if a file is no longer in the files vector (or has been modified)
-                    auto it = std::find_if(tmp_files.begin(), tmp_files.end(),
-                                           [x](const std::pair<std::string, time_t> &e){
-                                               return e.first == x.first;
-                                           });
-                    time_t version = 0;
-                    if (it != tmp_files.end()) {
-                        version = it->second;
-                        // check if version matches current file version
-                        if (it->second != x.second)
-                            request = '2';
-                    }
-                    else
-                        request = '2';
-                    
-                    // send the registry type for the file
-                    if (send(socket_fd, &request, sizeof(request), 0) < 0) {
-                        log(_client_log, "server unresponsive", "ignoring request");
-                    }
-                    else {
-                        bzero(buffer, MAX_FILENAME_SIZE);
-                        strcpy(buffer, x.first.c_str());
-                        // register file with the peer
-                        if (send(socket_fd, buffer, sizeof(buffer), 0) < 0)
-                            log(_client_log, "server unresponsive", "ignoring request");
-                        
-                        if (request == '2') {
-                            // send version of file to invalidate
-                            if (send(socket_fd, &version, sizeof(version), 0) < 0)
-                                log(_client_log, "server unresponsive", "ignoring request");
-                        }
+        // send a registry or deregistry message for a single file to the peer
+        void send_registration(int socket_fd, int type, std::string filename, time_t version, int origin=0) {
+            std::lock_guard<std::mutex> guard(_peer_m);
+            if (!_protocol.send_message(socket_fd, registration(type, filename, version, origin)))
+                log(_client_log, "server unresponsive", "ignoring request", LOG_WARNING);
+        }
+
+        // send a cycle's registration changes as a single batch and wait for the peer to acknowledge it
+        // the legacy wire format has no batches, so every change is sent on its own without an acknowledgement
+        bool send_registrations(int socket_fd, const std::vector<message> &changes) {
+            std::lock_guard<std::mutex> guard(_peer_m);
+            if (_protocol.wire_format == LEGACY) {
+                for (auto&& change : changes) {
+                    if (!_protocol.send_message(socket_fd, change)) {
+                        log(_client_log, "server unresponsive", "ignoring request", LOG_WARNING);
+                        return false;
                     }
                 }
-                // replace the old files vector with the new one
-                _local_files = tmp_files;
-
-                // reigster files from remote files directory
-                auto time_now = std::chrono::system_clock::now();
-                for (auto it = _remote_files.begin(); it < _remote_files.end();) {
-                    // check time since last poll when using PULL FROM NODE consistency method
-                    if (_consistency_method == PULL_N) {
-                        if (std::chrono::duration_cast<std::chrono::seconds>(time_now - it->check_time).count() >= _ttr)
-                            poll_origin_node(std::ref(*it));
-                    }
+                return true;
+            }
+            message msg;
+            msg.type = REGISTRY_BATCH;
+            msg.request_id = ++_registration_id;
+            msg.text = _protocol.encode_batch(changes);
+            message ack;
+            if (!_protocol.send_message(socket_fd, msg) || !_protocol.recv_reply(socket_fd, REGISTRY_ACK, ack) ||
+                ack.request_id != msg.request_id) {
+                log(_client_log, "server unresponsive", "registrations not acknowledged", LOG_WARNING);
+                return false;
+            }
+            return true;
+        }
 
-                    // send dereigstry request if file has been marked invalid
-                    char request = '1';
-                    if (it->valid == false) {
-                        request = '2';
+        // registers every file once when the node connects, then only what changed since the peer last acknowledged
+        void register_files(int socket_fd) {
+            std::unordered_map<std::string, _local_file> registered; // local files and versions the peer has acknowledged
+            std::set<std::pair<int, std::string>> registered_remote; // origin node and name of acknowledged cached copies
+            auto last_rescan = std::chrono::steady_clock::now();
+            while (1) {
+                std::vector<message> changes;
+
+                // the watcher keeps the local files up to date, a full rescan is only a fallback
+                if (!_watching || _rescan.exchange(false) ||
+                    std::chrono::steady_clock::now() - last_rescan >= std::chrono::seconds(LOCAL_RESCAN_INTERVAL)) {
+                    std::unordered_map<std::string, _local_file> tmp_files = get_files();
+                    // changes the watcher missed may include files kept open to be served
+                    _served_files.clear();
+                    std::lock_guard<std::mutex> guard(_local_files_m);
+                    for (auto&& x : tmp_files)
+                        keep_version(_local_files, x.first, x.second);
+                    for (auto&& x : _local_files) {
+                        if (tmp_files.find(x.first) == tmp_files.end())
+                            _content_hashes.remove(x.first);
                     }
+                    _local_files = tmp_files;
+                    last_rescan = std::chrono::steady_clock::now();
+                }
 
-                    // send registration type
-                    if (send(socket_fd, &request, sizeof(request), 0) < 0) {
-                        log(_client_log, "server unresponsive", "ignoring request");
-                    }
-                    else {
-                        bzero(buffer, MAX_FILENAME_SIZE);
-                        strcpy(buffer, it->origin_name.c_str());
-                        // register file with the peer
-                        if (send(socket_fd, buffer, sizeof(buffer), 0) < 0)
-                            log(_client_log, "server unresponsive", "ignoring request");
-                        
-                        if (request == '2') {
-                            // send version for deregistry
-                            // -1 used as special value to tell super peer that this file is not from the origin server
-                            time_t version = -1;
-                            if (send(socket_fd, &version, sizeof(version), 0) < 0)
-                                log(_client_log, "server unresponsive", "ignoring request");
-                            else {
-                                std::lock_guard<std::mutex> guard(_remote_files_m);
-                                _remote_files.erase(it);
-                            }
-                        }
-                        else
-                            it++;
+                // compare local files directory with what the peer has
+                std::unordered_map<std::string, _local_file> local;
+                {
+                    std::lock_guard<std::mutex> guard(_local_files_m);
+                    local = _local_files;
+                }
+                for (auto&& x : registered) {
+                    auto it = local.find(x.first);
+                    // deregister removed files, and modified files with their new version and hash to invalidate cached copies
+                    // a change within the same second, or one keeping its modification time, only shows in the hash
+                    if (it == local.end())
+                        changes.push_back(registration(DEREGISTRY, x.first, 0));
+                    else if (it->second.version != x.second.version || it->second.hash != x.second.hash) {
+                        changes.push_back(registration(DEREGISTRY, x.first, it->second.version));
+                        changes.back().hash = it->second.hash;
+                        changes.push_back(registration(REGISTRY, x.first, 0));
                     }
                 }
-                // wait 5 seconds to update files list 
-                sleep(5);
-            }
-        }
+                for (auto&& x : local) {
+                    if (registered.find(x.first) == registered.end())
+                        changes.push_back(registration(REGISTRY, x.first, 0));
+                }
 
-        // polls the origin node for a remote file to see if the cached version is valid
-        void poll_origin_node(_remote_file &remote_file) {
-            remote_file.check_time = std::chrono::system_clock::now();
-            int socket_fd = connect_server(remote_file.origin_node, false);
-            // remove file from remote files if origin node cannot be reached
-            if (socket_fd < 0) {
-                log(_client_log, "failed node connection", "ignoring connection");
-                remote_file.valid = false;
-                std::string filename_path = _remote_files_path + remote_file.local_name;
-                remove(filename_path.c_str());
-                std::string msg = "remote file \"" + remote_file.local_name + "\" modified";
-                log(_client_log, "removing file", msg);
-                eval_log(_client_log, "RMV", std::to_string(remote_file.origin_node) + '/' + remote_file.origin_name);
+                // poll the origin node of files not checked within ttr when using PULL FROM NODE consistency method
+                if (_consistency_method == PULL_N) {
+                    // every origin node is polled for all of its files over a single session
+                    std::unordered_map<int, std::vector<RemoteFiles::file>> due;
+                    for (auto&& x : _remote_files.due())
+                        due[x.origin_node].push_back(x);
+                    for (auto&& x : due)
+                        poll_origin_node(x.first, x.second);
+                }
 
+                // compare remote files directory with what the peer has, dropping files marked invalid deregisters them below
+                std::set<std::pair<int, std::string>> remote = _remote_files.drop_invalid();
+                for (auto&& x : registered_remote) {
+                    if (remote.find(x) == remote.end())
+                        changes.push_back(registration(REMOTE_DEREGISTRY, x.second, -1, x.first));
+                }
+                for (auto&& x : remote) {
+                    // subscribes the node to invalidations of the file from its origin node
+                    if (registered_remote.find(x) == registered_remote.end())
+                        changes.push_back(registration(REMOTE_REGISTRY, x.second, 0, x.first));
+                }
+
+                // changes which were not acknowledged are sent again next time
+                if (changes.empty() || send_registrations(socket_fd, changes)) {
+                    registered = local;
+                    registered_remote = remote;
+                }
+                // wait for the next update, or until the watcher sees a local file change
+                std::unique_lock<std::mutex> lock(_files_changed_m);
+                // polls wake it as soon as the next cached copy is due
+                std::chrono::milliseconds wait = std::chrono::seconds(REGISTRATION_INTERVAL);
+                if (_consistency_method == PULL_N && _ttr > 0)
+                    wait = _remote_files.next_due(wait);
+                _files_changed_cv.wait_for(lock, wait, [this]{ return _files_changed; });
+                _files_changed = false;
             }
-            if (send(socket_fd, "1", sizeof(char), 0) < 0)
-                log(_client_log, "node unresponsive", "ignoring request");
-            else {
-                if (send(socket_fd, "2", sizeof(char), 0) < 0)
-                    log(_client_log, "node unresponsive", "ignoring request");
-                else {
-                    // send filename of file to compare
-                    char buffer[MAX_FILENAME_SIZE];
-                    strcpy(buffer, remote_file.origin_name.c_str());
-                    if (send(socket_fd, buffer, sizeof(buffer), 0) < 0)
-                        log(_client_log, "peer unresponsive", "ignoring request");
-                    else {
-                        // send version of file to compare
-                        if (send(socket_fd, &remote_file.version, sizeof(remote_file.version), 0) < 0)
-                            log(_client_log, "peer unresponsive", "ignoring request");
-                        else {
-                            // set valid flag based on response from origin node
-                            if (recv(socket_fd, &remote_file.valid, sizeof(remote_file.valid), 0) < 0)
-                               log(_client_log, "peer unresponsive", "ignoring request");
-                            else {
-                                // remove file if it is no longer valid
-                                if (!remote_file.valid) {
-                                    std::string filename_path = _remote_files_path + remote_file.local_name;
-                                    remove(filename_path.c_str());
-                                    std::string msg = "remote file \"" + remote_file.local_name + "\" modified";
-                                    log(_client_log, "removing file", msg);
-                                    eval_log(_client_log, "RMV", std::to_string(remote_file.origin_node) + '/' + remote_file.origin_name);
-                                }
-                            }
-                        }
-                    }
+        }
+
+        // send requests to a node server and hand each reply to handle_reply in order
+        // framed requests share a single session, with at most PIPELINE_DEPTH of them sent ahead of their replies,
+        // legacy requests each get a connection of their own
+        // handle_reply returns false once the connection can no longer be used, returns how many replies were handled
+        // or -1 if the node could not be reached
+        int pipeline(int node, const std::vector<message> &requests, std::function<bool(int, size_t)> handle_reply) {
+            int answered = 0;
+            if (_protocol.wire_format == LEGACY) {
+                for (auto&& request : requests) {
+                    int socket_fd = connect_server(node, false);
+                    if (socket_fd < 0)
+                        return (answered == 0) ? -1 : answered;
+                    bool handled = _protocol.send_message(socket_fd, request) && handle_reply(socket_fd, answered++);
+                    close(socket_fd);
+                    if (!handled)
+                        break;
                 }
+                return answered;
+            }
+            int socket_fd = open_session(node);
+            if (socket_fd < 0)
+                return -1;
+            bool open = true;
+            size_t sent = 0;
+            while (open && (size_t)answered < requests.size()) {
+                while (open && sent < requests.size() && sent - answered < PIPELINE_DEPTH)
+                    open = _protocol.send_message(socket_fd, requests[sent++]);
+                if (open)
+                    open = handle_reply(socket_fd, answered++);
             }
             close(socket_fd);
+            return answered;
+        }
+
+        // connect to a node server for a session carrying any number of framed requests, returns -1 on failure
+        int open_session(int node) {
+            int socket_fd = connect_server(node, false);
+            if (socket_fd < 0)
+                return -1;
+            message session;
+            session.type = LEAF_SESSION;
+            if (!_protocol.send_message(socket_fd, session)) {
+                close(socket_fd);
+                return -1;
+            }
+            return socket_fd;
+        }
+
+        // polls an origin node for its remote files to see if the cached versions are valid
+        void poll_origin_node(int origin, const std::vector<RemoteFiles::file> &remote_files) {
+            std::vector<message> polls;
+            for (auto&& remote_file : remote_files) {
+                // send filename and version of file to compare, the origin node is kept for invalidating it
+                message msg;
+                msg.type = POLL;
+                msg.id = origin;
+                msg.filename = remote_file.origin_name;
+                msg.version = remote_file.version;
+                msg.hash = remote_file.hash;
+                polls.push_back(msg);
+            }
+            // remove a file if it is no longer valid, unless a newer version was downloaded while polling
+            auto invalidate = [this](const message &poll) {
+                time_t version = poll.version;
+                RemoteFiles::file invalidated;
+                if (_remote_files.invalidate(poll.id, poll.filename,
+                                             [version](const RemoteFiles::file &cached){ return cached.version == version; }, invalidated))
+                    remove_remote_file(invalidated);
+            };
+            size_t replies = 0;
+            int answered = pipeline(origin, polls, [&](int socket_fd, size_t i) {
+                message reply;
+                if (!_protocol.recv_reply(socket_fd, POLL_REPLY, reply))
+                    return false;
+                replies++;
+                if (!reply.valid)
+                    invalidate(polls[i]);
+                else
+                    _remote_files.extend(origin, polls[i].filename, polls[i].version, TTR_GROWTH, _ttr_max);
+                return true;
+            });
+            // remove files from remote files if origin node cannot be reached
+            if (answered < 0) {
+                log(_client_log, "failed node connection", "ignoring connection", LOG_WARNING);
+                for (auto&& poll : polls)
+                    invalidate(poll);
+            }
+            else if (replies < polls.size())
+                log(_client_log, "node unresponsive", "ignoring request", LOG_WARNING);
+            eval_log(_client_log, "POLL", std::to_string(polls.size()));
         }
         
         // handle user interface for sending a search request to the peer
         void search_request(int socket_fd) {
             std::cout << "filename: ";
-            char filename[MAX_FILENAME_SIZE];
+            std::string filename;
             std::cin >> filename;
-            // send a search request to the peer
-            if (send(socket_fd, "3", sizeof(char), 0) < 0) {
+            // send a search request with the filename to the peer
+            message msg;
+            msg.type = SEARCH;
+            msg.filename = filename;
+            message reply;
+            bool replied;
+            {
+                // recieve list of nodes with file from peer
+                std::lock_guard<std::mutex> guard(_peer_m);
+                replied = _protocol.send_message(socket_fd, msg) && _protocol.recv_reply(socket_fd, SEARCH_REPLY, reply);
+            }
+            if (!replied) {
                 std::cout << "\nunexpected connection issue: no search performed\n" << std::endl;
-                log(_client_log, "server unresponsive", "ignoring request");
+                log(_client_log, "server unresponsive", "ignoring request", LOG_WARNING);
+            }
+            // output appropriate message to node client
+            else if (reply.text.empty()) {
+                std::cout << "\nfile \"" << filename << "\" not found\n" << std::endl;
+                eval_log(_client_log, "SRCH", "FAIL");
             }
             else {
-                // send the filename to search to the peer
-                if (send(socket_fd, filename, sizeof(filename), 0) < 0) {
-                    std::cout << "\nunexpected connection issue: no search performed\n" << std::endl;
-                    log(_client_log, "server unresponsive", "ignoring request");
-                }
-                else {
-                    // recieve list of nodes with file from peer
-                    // output appropriate message to node client
-                    char buffer[MAX_MSG_SIZE];
-                    if (recv(socket_fd, buffer, sizeof(buffer), 0) < 0) {
-                        std::cout << "\nunexpected connection issue: no search performed\n" << std::endl;
-                        log(_client_log, "server unresponsive", "ignoring request");
-                    }
-                    else if (!buffer[0]) {
-                        std::cout << "\nfile \"" << filename << "\" not found\n" << std::endl;
-                        eval_log(_client_log, "SRCH", "FAIL");
-                    }
-                    else {
-                        std::cout << "\nnode(s) with file \"" << filename << "\": " << buffer << '\n' << std::endl;
-                        eval_log(_client_log, "SRCH", std::string(filename) + "] [" + std::string(buffer));
-                    }
-                }
+                std::cout << "\nnode(s) with file \"" << filename << "\": " << reply.text << '\n' << std::endl;
+                eval_log(_client_log, "SRCH", filename + "] [" + reply.text);
             }
         }
 
@@ -535,10 +799,7 @@ class LeafNode {
             size_t extension_idx = filename.find_last_of('.');
             local_filename << filename.substr(0, extension_idx);
             // add the file origin if the file already exists in the local "remote" directory
-            if ((std::find_if(_remote_files.begin(), _remote_files.end(),
-                              [filename, node](const _remote_file &e){
-                                  return e.local_name == filename && e.origin_node != node;
-                              }) != _remote_files.end()))
+            if (_remote_files.local_name_taken(filename, node))
                 local_filename << "-origin-" << node;
             local_filename << filename.substr(extension_idx, filename.size() - extension_idx);
 
@@ -546,141 +807,650 @@ class LeafNode {
         }
         
         // handle user interface for sending a retrieve request to a node server
-        void obtain_request() {
+        void obtain_request(int peer_fd) {
             std::cout << "node: ";
-            char node[6];
+            std::string node;
             std::cin >> node;
             // check if the passed-in node is the current client
-            if (atoi(node) == _port) {
+            if (atoi(node.c_str()) == _port) {
                 std::cout << "\nnode '" << node << "' is current client: no retreival performed\n" << std::endl;
                 return;
             }
-            // connect to the given node server
-            int socket_fd = connect_server(atoi(node), false);
-            if (socket_fd < 0) {
+            
+            std::cout << "filename: ";
+            std::string filename;
+            std::cin >> filename;
+            obtain_file(peer_fd, node, filename);
+        }
+
+        // obtain the whole of a single file from a node server
+        void obtain_file(int peer_fd, const std::string &node, const std::string &filename) {
+            message msg = obtain_message(filename);
+            if (pipeline(atoi(node.c_str()), {msg}, [&](int socket_fd, size_t) {
+                    return receive_obtain(peer_fd, socket_fd, node, msg);
+                }) < 0) {
                 std::cout << "\nnode '" << node << "' is not valid: no retreival performed\n" << std::endl;
-                log(_client_log, "failed node server connection", "ignoring request");
+                log(_client_log, "failed node server connection", "ignoring request", LOG_WARNING);
+            }
+        }
+
+        // handle user interface for refreshing a cached copy of a file from a node server
+        // only the blocks which changed since the cached copy, or else its stale copy, are downloaded
+        void refresh_request(int peer_fd) {
+            std::cout << "node: ";
+            std::string node;
+            std::cin >> node;
+            // check if the passed-in node is the current client
+            if (atoi(node.c_str()) == _port) {
+                std::cout << "\nnode '" << node << "' is current client: no retreival performed\n" << std::endl;
                 return;
             }
-            
-            if (send(socket_fd, "1", sizeof(char), 0) < 0) {
+
+            std::cout << "filename: ";
+            std::string filename;
+            std::cin >> filename;
+            // the copy is saved under its own local name, which differs from the filename when names clash,
+            // so it is looked up by the node first, then as a stale copy which is no longer listed under the name
+            // a copy from the node would be saved as, and last by the filename
+            RemoteFiles::file cached;
+            std::string basis_path;
+            if (_remote_files.find(atoi(node.c_str()), filename, cached))
+                basis_path = _remote_files_path + cached.local_name;
+            else {
+                basis_path = resolve_filename(filename, atoi(node.c_str()));
+                if (access((basis_path + ".stale").c_str(), F_OK) != 0 && _remote_files.find_local(filename, cached))
+                    basis_path = _remote_files_path + cached.local_name;
+            }
+            int basis_fd = open(basis_path.c_str(), O_RDONLY);
+            if (basis_fd == -1) {
+                basis_path += ".stale";
+                basis_fd = open(basis_path.c_str(), O_RDONLY);
+            }
+            struct stat basis_stat;
+            message msg;
+            msg.type = OBTAIN_DELTA;
+            msg.filename = filename;
+            bool has_basis = basis_fd != -1 && fstat(basis_fd, &basis_stat) == 0;
+            if (has_basis) {
+                msg.size = delta_block_size(basis_stat.st_size);
+                has_basis = delta_signatures(basis_fd, basis_stat.st_size, msg.size, msg.text) &&
+                            msg.text.size() <= MAX_FRAME_SIZE - MAX_MSG_SIZE;
+            }
+            // deltas are only sent framed, and without an old copy there is nothing to make one against
+            if (_protocol.wire_format == LEGACY || !has_basis) {
+                if (basis_fd != -1)
+                    close(basis_fd);
+                obtain_file(peer_fd, node, filename);
+                return;
+            }
+
+            bool rebuilt = true;
+            int answered = pipeline(atoi(node.c_str()), {msg}, [&](int socket_fd, size_t) {
+                return receive_delta(peer_fd, socket_fd, node, msg, basis_fd, basis_stat.st_size, basis_path, rebuilt);
+            });
+            close(basis_fd);
+            if (answered < 0) {
+                std::cout << "\nnode '" << node << "' is not valid: no retreival performed\n" << std::endl;
+                log(_client_log, "failed node server connection", "ignoring request", LOG_WARNING);
+            }
+            else if (!rebuilt) {
+                // the copy could not be rebuilt from the delta, the whole file is downloaded instead
+                log(_client_log, "failed delta refresh", "obtaining whole file", LOG_WARNING);
+                obtain_file(peer_fd, node, filename);
+            }
+        }
+
+        // receive the delta reply to a refresh and rebuild the file from it and the old copy in basis_fd
+        // rebuilt is cleared if the file could not be rebuilt, returns false if the connection can no longer be used
+        bool receive_delta(int peer_fd, int socket_fd, const std::string &node, const message &msg, int basis_fd,
+                           int64_t basis_size, const std::string &basis_path, bool &rebuilt) {
+            const std::string &filename = msg.filename;
+            message reply;
+            if (!_protocol.recv_reply(socket_fd, OBTAIN_DELTA_REPLY, reply)) {
+                std::cout << "\nunexpected connection issue: no retreival performed\n" << std::endl;
+                log(_client_log, "node unresponsive", "ignoring request", LOG_WARNING);
+                return false;
+            }
+            if (reply.size == -1) {
+                std::cout << "\nnode '" << node << "' does not have file \""
+                          << filename << "\": no retreival performed\n" << std::endl;
+                return true;
+            }
+            if (reply.size < 0) {
+                std::cout << "\ncould not read file \"" << filename
+                          << "\"'s stats: no retreival performed\n" << std::endl;
+                return true;
+            }
+
+            // the file is rebuilt next to the old copy, which stays in place until it is complete
+            std::string delta_path = _remote_files_path + filename + ".delta";
+            int fd = open(delta_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1) {
+                std::cout << "\nunable to create new file \"" << filename << "\": no retreival performed\n" << std::endl;
+                log(_client_log, "failed file open", "ignoring file", LOG_WARNING);
+                return false;
+            }
+            int64_t literal_bytes;
+            int64_t size = recv_delta(_protocol, socket_fd, basis_fd, basis_size, msg.size, fd, literal_bytes);
+            // the rebuilt file must hash to the node's copy, or a block was matched wrongly, and without a hash
+            // there is nothing to check it against, so the whole file is obtained instead
+            rebuilt = size == reply.size && reply.hash != 0 && hash_file(fd) == reply.hash;
+            close(fd);
+            if (!rebuilt || reply.id == _port) {
+                remove(delta_path.c_str());
+                if (rebuilt)
+                    std::cout << "\nfile is from current client: no retreival performed\n" << std::endl;
+                return size >= 0;
+            }
+
+            std::string local_filename_path = resolve_filename(filename, reply.id);
+            size_t filename_idx = local_filename_path.find_last_of('/');
+            std::string local_filename = local_filename_path.substr(filename_idx + 1);
+            if (rename(delta_path.c_str(), local_filename_path.c_str()) < 0) {
+                remove(delta_path.c_str());
+                std::cout << "\nunable to create new file \"" << local_filename
+                        << "\": no retreival performed\n" << std::endl;
+                log(_client_log, "failed file rename", "ignoring file", LOG_WARNING);
+                eval_log(_client_log, "OBTN", "FAIL");
+                return true;
+            }
+            // the stale copy the delta was made against, or any left from before, is no longer needed
+            if (basis_path != local_filename_path)
+                remove_leftover(basis_path.substr(_remote_files_path.size()));
+            remove_leftover(local_filename + ".stale");
+            add_remote_file(peer_fd, filename, local_filename, reply);
+            eval_log(_client_log, "OBTN", node + '/' + filename);
+            std::cout << "\ndislpay file '" << local_filename << "'\n. . .\n" << std::endl;
+            log(_client_log, "file download", "delta refresh successful, " + std::to_string(literal_bytes) + " of " +
+                                              std::to_string(reply.size) + " bytes changed");
+            return true;
+        }
+
+        // handle user interface for obtaining a list of files from a node server over a single session
+        void batch_request(int peer_fd) {
+            std::cout << "node: ";
+            std::string node;
+            std::cin >> node;
+            std::cout << "filenames (comma separated): ";
+            std::string filenames;
+            std::cin >> filenames;
+            if (atoi(node.c_str()) == _port) {
+                std::cout << "\nnode '" << node << "' is current client: no retreival performed\n" << std::endl;
+                return;
+            }
+
+            std::vector<message> requests;
+            std::stringstream list(filenames);
+            std::string filename;
+            while (std::getline(list, filename, ',')) {
+                if (!filename.empty())
+                    requests.push_back(obtain_message(filename));
+            }
+            int answered = pipeline(atoi(node.c_str()), requests, [&](int socket_fd, size_t i) {
+                return receive_obtain(peer_fd, socket_fd, node, requests[i]);
+            });
+            if (answered < 0) {
+                std::cout << "\nnode '" << node << "' is not valid: no retreival performed\n" << std::endl;
+                log(_client_log, "failed node server connection", "ignoring request", LOG_WARNING);
+                return;
+            }
+            // files after a broken connection were never answered
+            for (size_t i = answered; i < requests.size(); i++) {
+                std::cout << "\nunexpected connection issue: no retreival of file \"" << requests[i].filename
+                          << "\" performed\n" << std::endl;
+                eval_log(_client_log, "OBTN", "FAIL");
+            }
+        }
+
+        // obtain request for a file
+        message obtain_message(const std::string &filename) {
+            message msg;
+            msg.type = OBTAIN;
+            msg.filename = filename;
+            // downloads are written to a part file first, and a part left by an interrupted download is continued
+            // the node sends the file from the start instead if its copy is not the one the part was taken from
+            if (_protocol.wire_format == FRAMED) {
+                msg.type = OBTAIN_PART;
+                msg.size = INT64_MAX;
+                read_part(_remote_files_path + filename + ".part", msg.id, msg.version, msg.offset);
+                msg.codec = (_compression_level > 0) ? CODEC_ZLIB : CODEC_NONE;
+            }
+            return msg;
+        }
+
+        // receive the reply to an obtain request and the file following it
+        // returns false if the connection can no longer carry another reply
+        bool receive_obtain(int peer_fd, int socket_fd, const std::string &node, const message &msg) {
+            const std::string &filename = msg.filename;
+            std::string part_path = _remote_files_path + filename + ".part";
+            message reply;
+            // get the file size, origin node and version from the node server
+            if (!_protocol.recv_reply(socket_fd, (msg.type == OBTAIN_PART) ? OBTAIN_PART_REPLY : OBTAIN_REPLY, reply)) {
                 std::cout << "\nunexpected connection issue: no retreival performed\n" << std::endl;
-                log(_client_log, "node unresponsive", "ignoring request");
+                log(_client_log, "node unresponsive", "ignoring request", LOG_WARNING);
+                return false;
+            }
+            // handle message from node server
+            if (reply.size == -1) {
+                std::cout << "\nnode '" << node << "' does not have file \""
+                          << filename << "\": no retreival performed\n" << std::endl;
+                return true;
+            }
+            if (reply.size < 0) {
+                std::cout << "\ncould not read file \"" << filename
+                          << "\"'s stats: no retreival performed\n" << std::endl;
+                return true;
+            }
+            int64_t length = reply.size - reply.offset;
+            // the file is still read off the connection when it is not kept, so the next reply can be found
+            auto skip = [&]() {
+                return (reply.codec == CODEC_ZLIB) ? recv_compressed(_protocol, socket_fd, -1, 0, length) == length
+                                                   : skip_file_range(socket_fd, length);
+            };
+            if (reply.id == _port) {
+                std::cout << "\nfile is from current client: no retreival performed\n" << std::endl;
+                return skip();
+            }
+
+            int id = reply.id;
+            time_t version = reply.version;
+            int fd = open(part_path.c_str(), O_WRONLY | O_CREAT, 0644);
+            // anything the node does not continue from is from another copy
+            bool created = fd != -1 && ftruncate(fd, reply.offset) == 0 && write_part(part_path, id, version);
+            int64_t received = !created ? 0 :
+                               (reply.codec == CODEC_ZLIB) ? recv_compressed(_protocol, socket_fd, fd, reply.offset, length)
+                                                           : recv_file_range(socket_fd, fd, reply.offset, length);
+            if (fd != -1)
+                close(fd);
+            // create pretty filename for outputting results to node client
+            std::string local_filename_path = resolve_filename(filename, id);
+            size_t filename_idx = local_filename_path.find_last_of('/');
+            std::string local_filename = local_filename_path.substr(
+                filename_idx + 1, local_filename_path.size() - filename_idx
+            );
+            if (!created) {
+                std::cout << "\nunable to create new file \"" << local_filename
+                        << "\": no retreival performed\n" << std::endl;
+                log(_client_log, "failed file open", "ignoring file", LOG_WARNING);
+                eval_log(_client_log, "OBTN", "FAIL");
+                return skip();
+            }
+            if (received < length) {
+                // the part is kept, so obtaining the file again continues from here
+                std::cout << "\ndownload of file \"" << filename << "\" interrupted after "
+                          << reply.offset + received << " of " << reply.size << " bytes: obtain it again to continue\n" << std::endl;
+                log(_client_log, "node unresponsive", "keeping partial file", LOG_WARNING);
+                eval_log(_client_log, "OBTN", "FAIL");
+                _remote_files.keep_leftover(filename + ".part", reply.offset + received);
+                return false;
+            }
+            if (rename(part_path.c_str(), local_filename_path.c_str()) < 0) {
+                std::cout << "\nunable to create new file \"" << local_filename
+                        << "\": no retreival performed\n" << std::endl;
+                log(_client_log, "failed file rename", "ignoring file", LOG_WARNING);
+                eval_log(_client_log, "OBTN", "FAIL");
+                return true;
+            }
+            remove((part_path + ".info").c_str());
+            _remote_files.drop_leftover(filename + ".part");
+            remove_leftover(local_filename + ".stale");
+            if (reply.offset > 0)
+                log(_client_log, "file download", "continued from byte " + std::to_string(reply.offset));
+            add_remote_file(peer_fd, filename, local_filename, reply);
+            eval_log(_client_log, "OBTN", node + '/' + filename);
+            std::cout << "\ndislpay file '" << local_filename << "'\n. . .\n" << std::endl;
+            log(_client_log, "file download", "file download successful");
+            return true;
+        }
+
+        // origin node, version and size of a part file left by an interrupted download, all 0 if there is none
+        void read_part(const std::string &part_path, int &origin, time_t &version, int64_t &size) {
+            struct stat part_stat;
+            std::ifstream info(part_path + ".info");
+            origin = 0;
+            version = 0;
+            size = 0;
+            if (stat(part_path.c_str(), &part_stat) == 0 && (info >> origin >> version))
+                size = part_stat.st_size;
+        }
+
+        // record which copy of a file a part file is being downloaded from
+        bool write_part(const std::string &part_path, int origin, time_t version) {
+            std::ofstream info(part_path + ".info", std::ios::trunc);
+            info << origin << ' ' << version << std::endl;
+            return (bool)info;
+        }
+
+        // record a downloaded file in the remote files list and subscribe to its invalidations
+        // reply holds the origin node, version and content hash of the file
+        void add_remote_file(int peer_fd, const std::string &filename, std::string &local_filename, const message &reply) {
+            int id = reply.id;
+            time_t version = reply.version;
+            std::vector<RemoteFiles::file> evicted;
+            std::vector<std::string> evicted_leftovers;
+            // adds new file to remote files list if it doesnt exist
+            bool added = _remote_files.put({local_filename, filename, id, version, std::chrono::system_clock::now(), true,
+                                            reply.hash, reply.size, _ttr}, local_filename, evicted, evicted_leftovers);
+            // an open copy replaced by the download is not served again
+            _served_files.remove(local_filename);
+            if (added) {
+                std::cout << "\nfile \"" << filename << "\" downloaded as \""
+                        << local_filename << "\"\n" << std::endl;
             }
             else {
-                if (send(socket_fd, "1", sizeof(char), 0) < 0) {
-                    std::cout << "\nunexpected connection issue: no retreival performed\n" << std::endl;
-                    log(_client_log, "node unresponsive", "ignoring request");
+                // updates file if it already exists and prints new version to user
+                std::cout << "\nfile \"" << local_filename << "\" updated to version "
+                        << version << "\n" << std::endl;
+            }
+            // subscribe to invalidations right away instead of waiting for the next registration pass
+            send_registration(peer_fd, REMOTE_REGISTRY, filename, 0, id);
+            for (auto&& x : evicted_leftovers) {
+                remove((_remote_files_path + x).c_str());
+                remove((_remote_files_path + x + ".info").c_str());
+                log(_client_log, "evicting file", "leftover \"" + x + "\" oldest");
+            }
+            for (auto&& x : evicted)
+                evict_remote_file(peer_fd, x);
+        }
+
+        // delete a stale copy or part file from the remote files directory, which stops counting against its budget
+        void remove_leftover(const std::string &name) {
+            remove((_remote_files_path + name).c_str());
+            _remote_files.drop_leftover(name);
+        }
+
+        // delete a copy evicted from the remote files directory to keep it within its budget, along with any stale copy
+        // it is deregistered right away, as it may have been registered by add_remote_file before any registration pass
+        void evict_remote_file(int peer_fd, const RemoteFiles::file &remote_file) {
+            std::string filename_path = _remote_files_path + remote_file.local_name;
+            _served_files.remove(remote_file.local_name);
+            remove(filename_path.c_str());
+            remove_leftover(remote_file.local_name + ".stale");
+            log(_client_log, "evicting file", "remote file \"" + remote_file.local_name + "\" (" +
+                std::to_string(remote_file.size) + " bytes) least recently used");
+            send_registration(peer_fd, REMOTE_DEREGISTRY, remote_file.origin_name, -1, remote_file.origin_node);
+        }
+
+        // request a byte range of a file over a session with a node server and check it against its checksum
+        // reply holds the size, origin node, version and content hash of the whole file, data the bytes of the range
+        // the session can no longer be used once this fails
+        bool request_range(int socket_fd, int node, const std::string &filename, int64_t offset, int64_t size, message &reply,
+                           std::string &data) {
+            message msg;
+            msg.type = OBTAIN_RANGE;
+            msg.filename = filename;
+            msg.offset = offset;
+            msg.size = size;
+            bool received = _protocol.send_message(socket_fd, msg) && _protocol.recv_reply(socket_fd, OBTAIN_RANGE_REPLY, reply);
+            if (received && reply.size >= 0) {
+                // the server leaves out anything past the end of the file
+                int64_t length = std::max<int64_t>(std::min<int64_t>(std::min<int64_t>(size, reply.size - offset), MAX_RANGE_SIZE), 0);
+                data.resize(length);
+                received = length == 0 || _protocol.recv_all(socket_fd, &data[0], length);
+            }
+            if (!received) {
+                log(_client_log, "node unresponsive", "skipping node " + std::to_string(node), LOG_WARNING);
+                return false;
+            }
+            if (reply.size >= 0 && range_checksum(data.data(), data.size(), offset) != reply.checksum) {
+                log(_client_log, "failed checksum", "range at " + std::to_string(offset) + " of \"" + filename +
+                    "\" from node " + std::to_string(node), LOG_WARNING);
+                return false;
+            }
+            return true;
+        }
+
+        // handle user interface for downloading a file from every node holding it at once
+        // the file is split into chunks, each node's worker takes the next chunk nobody has fetched yet over a session
+        // of its own, so faster nodes serve more of the file and a node which fails only loses the chunk it was fetching
+        // the whole file is checked against the content hash of the chosen copy, which a checksum per range cannot catch
+        void swarm_request(int peer_fd) {
+            std::cout << "filename: ";
+            std::string filename;
+            std::cin >> filename;
+            if (_protocol.wire_format == LEGACY) {
+                std::cout << "\nswarming needs the framed wire format: no retreival performed\n" << std::endl;
+                return;
+            }
+
+            // find every node holding the file
+            message msg;
+            msg.type = SEARCH;
+            msg.filename = filename;
+            message reply;
+            bool replied;
+            {
+                std::lock_guard<std::mutex> guard(_peer_m);
+                replied = _protocol.send_message(peer_fd, msg) && _protocol.recv_reply(peer_fd, SEARCH_REPLY, reply);
+            }
+            if (!replied) {
+                std::cout << "\nunexpected connection issue: no retreival performed\n" << std::endl;
+                log(_client_log, "server unresponsive", "ignoring request", LOG_WARNING);
+                return;
+            }
+            std::vector<int> holders;
+            std::stringstream ids(reply.text);
+            std::string id_text;
+            while (std::getline(ids, id_text, ',')) {
+                int holder = atoi(id_text.c_str());
+                if (holder != _port && holder > 0 && holders.size() < SWARM_MAX_SOURCES)
+                    holders.push_back(holder);
+            }
+
+            // ask every holder for the size, origin, version and content hash of its copy, the origin node's own copy
+            // decides which version is downloaded, and otherwise the version most holders have
+            // the session each holder answered on is kept for fetching its chunks
+            std::vector<std::pair<int, message>> copies;
+            std::unordered_map<int, int> sessions;
+            for (auto&& holder : holders) {
+                message copy;
+                std::string data;
+                int socket_fd = open_session(holder);
+                if (socket_fd < 0) {
+                    log(_client_log, "failed node server connection", "skipping node " + std::to_string(holder), LOG_WARNING);
+                    continue;
                 }
+                if (request_range(socket_fd, holder, filename, 0, 0, copy, data) && copy.size >= 0) {
+                    copies.push_back({holder, copy});
+                    sessions[holder] = socket_fd;
+                }
+                else
+                    close(socket_fd);
+            }
+            auto close_sessions = [&]() {
+                for (auto&& x : sessions)
+                    close(x.second);
+                sessions.clear();
+            };
+            if (copies.empty()) {
+                close_sessions();
+                std::cout << "\nno node could send file \"" << filename << "\": no retreival performed\n" << std::endl;
+                eval_log(_client_log, "OBTN", "FAIL");
+                return;
+            }
+            auto same_copy = [](const message &a, const message &b) {
+                return a.id == b.id && a.version == b.version && a.size == b.size && a.hash == b.hash;
+            };
+            message chosen = copies[0].second;
+            size_t chosen_count = 0;
+            for (auto&& x : copies) {
+                size_t count = std::count_if(copies.begin(), copies.end(), [&](const std::pair<int, message> &y) {
+                                                 return same_copy(x.second, y.second);
+                                             });
+                if (x.first == x.second.id) {
+                    chosen = x.second;
+                    break;
+                }
+                if (count > chosen_count) {
+                    chosen = x.second;
+                    chosen_count = count;
+                }
+            }
+            if (chosen.id == _port) {
+                close_sessions();
+                std::cout << "\nfile is from current client: no retreival performed\n" << std::endl;
+                return;
+            }
+            std::vector<int> sources;
+            for (auto&& x : copies) {
+                if (same_copy(x.second, chosen))
+                    sources.push_back(x.first);
                 else {
-                    std::cout << "filename: ";
-                    char filename[MAX_FILENAME_SIZE];
-                    std::cin >> filename;
-                    if (send(socket_fd, filename, sizeof(filename), 0) < 0) {
-                        std::cout << "\nunexpected connection issue: no retreival performed\n" << std::endl;
-                        log(_client_log, "node unresponsive", "ignoring request");
+                    close(sessions[x.first]);
+                    sessions.erase(x.first);
+                }
+            }
+            // ranges are only known to make up the chosen copy once the whole file matches its content hash,
+            // so a copy without one is obtained from a single node instead
+            if (chosen.hash == 0) {
+                close_sessions();
+                log(_client_log, "no content hash", "obtaining \"" + filename + "\" from a single node", LOG_WARNING);
+                obtain_file(peer_fd, std::to_string(sources[0]), filename);
+                return;
+            }
+
+            std::string local_filename_path = resolve_filename(filename, chosen.id);
+            size_t filename_idx = local_filename_path.find_last_of('/');
+            std::string local_filename = local_filename_path.substr(filename_idx + 1);
+            // chunks arrive out of order, so unlike an obtain the part cannot be continued later and is never given a .info
+            std::string part_path = _remote_files_path + filename + ".part";
+            remove((part_path + ".info").c_str());
+            _remote_files.drop_leftover(filename + ".part");
+            int fd = open(part_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd >= 0 && chosen.size > 0)
+                fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, chosen.size);
+            if (fd < 0) {
+                close_sessions();
+                std::cout << "\nunable to create new file \"" << local_filename
+                          << "\": no retreival performed\n" << std::endl;
+                log(_client_log, "failed file open", "ignoring file", LOG_WARNING);
+                eval_log(_client_log, "OBTN", "FAIL");
+                return;
+            }
+
+            std::mutex m;
+            std::deque<int64_t> chunks; // chunks nobody has fetched yet
+            for (int64_t chunk = 0; chunk * SWARM_CHUNK_SIZE < chosen.size; chunk++)
+                chunks.push_back(chunk);
+            std::unordered_map<int64_t, int> chunk_failures;
+            std::unordered_map<int, int> node_failures;
+            std::unordered_map<int, int64_t> node_bytes;
+            bool failed = false;
+            auto start = std::chrono::steady_clock::now();
+            // a worker keeps using its node's session, and only reconnects after a failed request
+            auto worker = [&](int node, int socket_fd) {
+                while (1) {
+                    int64_t chunk;
+                    {
+                        std::lock_guard<std::mutex> guard(m);
+                        if (failed || chunks.empty() || node_failures[node] >= SWARM_RETRIES) {
+                            if (socket_fd >= 0)
+                                close(socket_fd);
+                            return;
+                        }
+                        chunk = chunks.front();
+                        chunks.pop_front();
                     }
+                    int64_t offset = chunk * SWARM_CHUNK_SIZE;
+                    int64_t length = std::min<int64_t>(SWARM_CHUNK_SIZE, chosen.size - offset);
+                    message range;
+                    std::string data;
+                    if (socket_fd < 0 && (socket_fd = open_session(node)) < 0)
+                        log(_client_log, "failed node server connection", "skipping node " + std::to_string(node), LOG_WARNING);
+                    // a node which changed its copy since it was asked cannot be mixed with the others
+                    bool fetched = socket_fd >= 0 && request_range(socket_fd, node, filename, offset, SWARM_CHUNK_SIZE, range, data) &&
+                                   same_copy(range, chosen) && (int64_t)data.size() == length;
+                    if (!fetched && socket_fd >= 0) {
+                        close(socket_fd);
+                        socket_fd = -1;
+                    }
+                    for (int64_t written = 0; fetched && written < length;) {
+                        ssize_t written_size = pwrite(fd, data.data() + written, length - written, offset + written);
+                        if (written_size <= 0)
+                            fetched = false;
+                        else
+                            written += written_size;
+                    }
+                    std::lock_guard<std::mutex> guard(m);
+                    if (fetched)
+                        node_bytes[node] += length;
                     else {
-                        char buffer[MAX_STAT_MSG_SIZE];
-                        // get the file size from the node server
-                        if (recv(socket_fd, buffer, sizeof(buffer), 0) < 0) {
-                            std::cout << "\nunexpected connection issue: no retreival performed\n" << std::endl;
-                            log(_client_log, "node unresponsive", "ignoring request");
-                        }
-                        else {
-                            int file_size = atoi(buffer);
-                            // handle message from node server
-                            if (file_size == -1)
-                                std::cout << "\nnode '" << node << "' does not have file \""
-                                          << filename << "\": no retreival performed\n" << std::endl;
-                            else if (file_size == -2)
-                                std::cout << "\ncould not read file \"" << filename
-                                          << "\"'s stats: no retreival performed\n" << std::endl;
-                            else {
-                                // get origin node of downloaded file
-                                int id;
-                                if (recv(socket_fd, &id, sizeof(id), 0) < 0 || id == _port) {
-                                    if (id == _port)
-                                        std::cout << "\nfile is from current client: no retreival performed\n" << std::endl;
-                                    else {
-                                        std::cout << "\nunexpected connection issue: no retreival performed\n" << std::endl;
-                                        log(_client_log, "node unresponsive", "ignoring request");
-                                    }
-                                }
-                                else {
-                                    // get version of dowloaded file
-                                    time_t version;
-                                    if (recv(socket_fd, &version, sizeof(version), 0) < 0) {
-                                        std::cout << "\nunexpected connection issue: no retreival performed\n" << std::endl;
-                                        log(_client_log, "node unresponsive", "ignoring request");
-                                    }
-                                    else {
-                                        // create pretty filename for outputting results to node client
-                                        std::string local_filename_path = resolve_filename(filename, id);
-                                        size_t filename_idx = local_filename_path.find_last_of('/');
-                                        std::string local_filename = local_filename_path.substr(
-                                            filename_idx + 1, local_filename_path.size() - filename_idx
-                                        );
-                                        FILE *file = fopen(local_filename_path.c_str(), "w");
-                                        if (file == NULL) {
-                                            std::cout << "\nunable to create new file \"" << local_filename
-                                                    << "\": no retreival performed\n" << std::endl;
-                                            log(_client_log, "failed file open", "ignoring file");
-                                            eval_log(_client_log, "OBTN", "FAIL");
-                                        }
-                                        else {
-                                            char buffer_[MAX_MSG_SIZE];
-                                            int remaining_size = file_size;
-                                            int received_size;
-                                            // write blocks recieved from node server to new file
-                                            while (((received_size = recv(socket_fd, buffer_, sizeof(buffer_), 0)) > 0) && (remaining_size > 0)) {
-                                                fwrite(buffer_, sizeof(char), received_size, file);
-                                                remaining_size -= received_size;
-                                            }
-                                            fclose(file);
-                                            auto it = std::find_if(_remote_files.begin(), _remote_files.end(),
-                                                                   [filename, id](const _remote_file &e){
-                                                                       return e.origin_name == filename && e.origin_node == id;
-                                                                   });
-                                            // adds new file to remote files list if it doesnt exist
-                                            if(it == _remote_files.end()) {
-                                                _remote_files.push_back({local_filename, filename, id, version,
-                                                                        std::chrono::system_clock::now(), true});
-                                                std::cout << "\nfile \"" << filename << "\" downloaded as \""
-                                                        << local_filename << "\"\n" << std::endl;
-                                            }
-                                            else {
-                                                // updates file if it already exists and prints new version to user
-                                                it->version = version;
-                                                std::cout << "\nfile \"" << local_filename << "\" updated to version "
-                                                        << version << "\n" << std::endl;
-                                            }
-                                            eval_log(_client_log, "OBTN", std::string(node) + '/' + std::string(filename));
-                                            std::cout << "\ndislpay file '" << local_filename << "'\n. . .\n" << std::endl;
-                                            log(_client_log, "file download", "file download successful");
-                                        }
-                                    }
-                                }
-                            }
-                        }
+                        node_failures[node]++;
+                        if (++chunk_failures[chunk] > SWARM_RETRIES)
+                            failed = true;
+                        chunks.push_back(chunk);
                     }
                 }
+            };
+            // chunks given back by a failing node after the others finished are fetched in another round
+            while (!failed && !chunks.empty()) {
+                std::vector<std::thread> workers;
+                for (auto&& node : sources) {
+                    // sessions from the first round are handed over, later rounds open new ones
+                    auto session = sessions.find(node);
+                    int socket_fd = (session != sessions.end()) ? session->second : -1;
+                    if (session != sessions.end())
+                        sessions.erase(session);
+                    if (node_failures[node] < SWARM_RETRIES)
+                        workers.emplace_back(worker, node, socket_fd);
+                    else if (socket_fd >= 0)
+                        close(socket_fd);
+                }
+                if (workers.empty())
+                    failed = true;
+                for (auto&& w : workers)
+                    w.join();
             }
-            close(socket_fd);
+            close_sessions();
+            // every range matched its checksum, but only the content hash shows the ranges make up the chosen copy
+            if (!failed && hash_file(fd) != chosen.hash) {
+                log(_client_log, "failed content hash", "swarm download of \"" + filename + "\" does not match its origin",
+                    LOG_WARNING);
+                failed = true;
+            }
+            close(fd);
+
+            if (!failed && rename(part_path.c_str(), local_filename_path.c_str()) < 0)
+                failed = true;
+            if (failed) {
+                remove(part_path.c_str());
+                std::cout << "\ncould not download every part of file \"" << filename
+                          << "\": no retreival performed\n" << std::endl;
+                log(_client_log, "failed swarm download", "removing partial file", LOG_WARNING);
+                eval_log(_client_log, "OBTN", "FAIL");
+                return;
+            }
+            add_remote_file(peer_fd, filename, local_filename, chosen);
+            eval_log(_client_log, "OBTN", std::to_string(chosen.id) + '/' + filename);
+            int64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            std::ostringstream shares;
+            shares << chosen.size << " bytes in " << elapsed << " ms, bytes per node ";
+            for (auto&& node : sources)
+                shares << node << ':' << node_bytes[node] << (node == sources.back() ? "" : ",");
+            std::cout << "\ndislpay file '" << local_filename << "'\n. . .\n" << std::endl;
+            log(_client_log, "file download", "swarm download successful, " + shares.str());
         }
 
         void print_files() {
             std::cout << "\n__________LOCAL FILES__________" << std::endl;
-            std::cout << "[filename] [version]" << std::endl;
+            std::cout << "[filename] [version] [hash]" << std::endl;
+            std::unique_lock<std::mutex> local_guard(_local_files_m);
             for (auto &&x : _local_files) {
-                std::cout << '[' << x.first << "] [" << x.second << ']' << std::endl;
+                std::cout << '[' << x.first << "] [" << x.second.version << "] [" << std::hex << x.second.hash << std::dec
+                          << ']' << std::endl;
             }
             std::cout << "_______________________________" << std::endl;
             std::cout << "__________REMOTE FILES__________" << std::endl;
-            std::cout << "[local filename] [origin filename] [origin node] [validity] [version]" << std::endl;
-            for (auto &&x : _remote_files) {
+            int64_t budget = _remote_files.budget();
+            std::cout << "cache: " << _remote_files.bytes() << " of " << (budget > 0 ? std::to_string(budget) : "unlimited")
+                      << " bytes, "
+                      << _remote_files.hits << " hits, " << _remote_files.misses << " misses, "
+                      << _remote_files.evictions << " evictions" << std::endl;
+            std::cout << "served files: " << _served_files.hits << " hits, " << _served_files.misses << " misses" << std::endl;
+            std::cout << "[local filename] [origin filename] [origin node] [validity] [version] [ttr]" << std::endl;
+            for (auto &&x : _remote_files.snapshot()) {
                 std::cout << '[' << x.local_name << "] [" << x.origin_name << "] [" << x.origin_node
-                          << "] [" << x.valid << "] [" << x.version << ']' << std::endl;
+                          << "] [" << x.valid << "] [" << x.version << "] [" << x.ttr << ']' << std::endl;
             }
             std::cout << "________________________________\n" << std::endl;
         }
@@ -694,6 +1464,9 @@ class LeafNode {
             int id;
             int port;
             int peer_id;
+            std::string key;
+            std::string value;
+            bool found = false;
 
             config >> _consistency_method;
             if (_consistency_method == PULL_N || _consistency_method == PULL_P) {
@@ -709,13 +1482,39 @@ class LeafNode {
                     if (id == _id) {
                         _port = port;
                         _peer_id = peer_id;
-                        return;
+                        found = true;
                     }
                 }
+                else if (member_type == 2) {
+                    // optional settings shared by the whole network
+                    config >> key >> value;
+                    _options[key] = value;
+                }
                 else
                     std::getline(config, tmp); // ignore anything else in the line
             }
-            error("invalid id");
+            if (!found)
+                error("invalid id");
+        }
+
+        // gets an optional setting from the config file, or the default if it was not set
+        std::string option(std::string key, std::string default_value) {
+            auto it = _options.find(key);
+            return (it != _options.end()) ? it->second : default_value;
+        }
+
+        int int_option(std::string key, int default_value) {
+            auto it = _options.find(key);
+            return (it != _options.end()) ? atoi(it->second.c_str()) : default_value;
+        }
+
+        // send a request which has no fields to the peer
+        void send_request(int socket_fd, int type) {
+            message msg;
+            msg.type = type;
+            std::lock_guard<std::mutex> guard(_peer_m);
+            if (!_protocol.send_message(socket_fd, msg))
+                log(_client_log, "server unresponsive", "ignoring request", LOG_WARNING);
         }
 
     public:
@@ -726,17 +1525,40 @@ class LeafNode {
         int _peer_id;
         int _socket_fd;
         int _consistency_method;
-        int _ttr = 0;
+        int _ttr = 0; // shortest time between polls of a cached copy, which every new copy starts from
+        int _ttr_max = 0; // longest time a cached copy found unchanged is left between polls
 
         LeafNode(int id, std::string config_path, std::string directory) {
             _id = id;
             get_network(config_path);
+            _protocol.wire_format = (option("wire_format", "framed") == "legacy") ? LEGACY : FRAMED;
+            // only framed part requests can ask for compression
+            if (option("compression", "none") == "zlib" && _protocol.wire_format == FRAMED)
+                _compression_level = std::min(std::max(1, int_option("compression_level", 1)), 9);
+            _compressed_files.set_budget((size_t)std::max(0, int_option("compression_cache", 64)) * 1024 * 1024);
+            _remote_files.set_budget((int64_t)std::max(0, int_option("remote_cache", 0)) * 1024 * 1024);
+            _served_files.set_capacity(std::max(0, int_option("serve_cache", 64)));
+            _ttr_max = std::max(_ttr, int_option("ttr_max", _ttr));
             
             // add ending '/' if missing in directory argument
             if (directory.back() != '/')
                 directory += '/';
             _local_files_path = directory + "local/";
             _remote_files_path = directory + "remote/";
+            // start logging for both node client and node server before the first scan, which may already log,
+            // nothing is echoed to stdout unless configured
+            std::string log_name_prefix = "logs/leaf_nodes/" + std::to_string(_port);
+            int level = Logger::level(option("log_level", "debug"), LOG_DEBUG);
+            _server_log = _logger.open(log_name_prefix + "_server.log", level);
+            _client_log = _logger.open(log_name_prefix + "_client.log", level);
+            _logger.echo(Logger::level(option("log_stdout", "none"), LOG_NONE));
+            _logger.start();
+
+            // watch the directory before the first scan so no change falls between them
+            _inotify_fd = inotify_init1(IN_CLOEXEC);
+            if (_inotify_fd >= 0 && inotify_add_watch(_inotify_fd, _local_files_path.c_str(), IN_MODIFY | IN_CLOSE_WRITE |
+                                                      IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) >= 0)
+                _watching = true;
             _local_files = get_files();
 
             struct sockaddr_in addr;
@@ -748,6 +1570,9 @@ class LeafNode {
             addr.sin_port = htons(_port);
 
             _socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+            // a restarted node takes its port back right away, so clients can continue downloads from it
+            int reuse = 1;
+            setsockopt(_socket_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
             // bind socket to port to be used for node server
             if (bind(_socket_fd, (struct sockaddr*)&addr, addr_size) < 0)
@@ -755,21 +1580,16 @@ class LeafNode {
 
             std::cout << "current node id: " << _port << '\n' << std::endl;
 
-            // start logging for both node client and node server
-            std::string log_name_prefix = "logs/leaf_nodes/" + std::to_string(_port);
-            _server_log.open(log_name_prefix + "_server.log");
-            _client_log.open(log_name_prefix + "_client.log");
         }
         
         void run_client() {
             int socket_fd = connect_server(_peer_id);
 
-            //send type id to be used as client id in peer
-            if (send(socket_fd, "1", sizeof(char), 0) < 0)
-                error("server unreachable");
-
             //send node server port number to be used as client id in peer
-            if (send(socket_fd, &_port, sizeof(_port), 0) < 0)
+            message msg;
+            msg.type = NODE_CONNECT;
+            msg.id = _port;
+            if (!_protocol.send_message(socket_fd, msg))
                 error("server unreachable");
 
             //start thread for automatic files updater
@@ -779,7 +1599,7 @@ class LeafNode {
             //continously prompt user for request
             while (1) {
                 std::string request;
-                std::cout << "request [(s)earch|(o)btain|(r)efresh|(q)uit]: ";
+                std::cout << "request [(s)earch|(o)btain|(b)atch obtain|s(w)arm obtain|(r)efresh|(q)uit]: ";
                 std::cin >> request;
 
                 switch (request[0]) {
@@ -789,27 +1609,37 @@ class LeafNode {
                         break;
                     case 'o':
                     case 'O':
-                        obtain_request();
+                        obtain_request(socket_fd);
+                        break;
+                    case 'b':
+                    case 'B':
+                        batch_request(socket_fd);
+                        break;
+                    case 'w':
+                    case 'W':
+                        swarm_request(socket_fd);
                         break;
                     case 'q':
                     case 'Q':
+                        send_request(socket_fd, NODE_DISCONNECT);
                         close(socket_fd);
+                        _logger.stop();
                         exit(0);
                         break;
                     case 'l':
                     case 'L':
                         // used for testing to see all registered files
-                        send(socket_fd, "4", sizeof(char), 0);
+                        send_request(socket_fd, PRINT_FILES_INDEX);
                         break;
                     case 'm':
                     case 'M':
                         // used for testing to see current message ids list
-                        send(socket_fd, "5", sizeof(char), 0);
+                        send_request(socket_fd, PRINT_MESSAGE_IDS);
                         break;
                     case 'd':
                     case 'D':
                         // used for testing to see current modified files list
-                        send(socket_fd, "6", sizeof(char), 0);
+                        send_request(socket_fd, PRINT_MODIFIED_FILES);
                         break;
                     case 'f':
                     case 'F':
@@ -817,7 +1647,7 @@ class LeafNode {
                         break;
                     case 'r':
                     case 'R':
-                        obtain_request();
+                        refresh_request(socket_fd);
                         break;
                     default:
                         std::cout << "\nunexpected request\n" << std::endl;
@@ -838,12 +1668,12 @@ class LeafNode {
 
                 if ((socket_fd = accept(_socket_fd, (struct sockaddr*)&addr, &addr_size)) < 0) {
                     // ignore any failed connections from node clients
-                    log(_server_log, "failed client connection", "ignoring connection");
+                    log(_server_log, "failed client connection", "ignoring connection", LOG_WARNING);
                     continue;
                 }
 
                 connection << inet_ntoa(addr.sin_addr) << '@' << ntohs(addr.sin_port);
-                log(_server_log, "client connected", connection.str());
+                log(_server_log, "client connected", connection.str(), LOG_DEBUG);
 
                 // start thread for performing file download
                 std::thread t(&LeafNode::handle_connection, this, socket_fd);
@@ -858,6 +1688,10 @@ class LeafNode {
             // start independent threads for both client and server
             std::thread c_t(&LeafNode::run_client, this);
             std::thread s_t(&LeafNode::run_server, this);
+            if (_watching) {
+                std::thread w_t(&LeafNode::watch_local_files, this);
+                w_t.detach();
+            }
 
             c_t.join();
             s_t.join();
@@ -865,8 +1699,6 @@ class LeafNode {
 
         ~LeafNode() {
             close(_socket_fd);
-            _server_log.close();
-            _client_log.close();
         }
 };
 
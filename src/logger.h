@@ -0,0 +1,291 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+#define LOG_RECORD_SIZE 256 // bytes per log record, longer lines are cut short
+#define LOG_RING_RECORDS 128 // records a thread can have waiting for the writer
+#define LOG_SPARE_RINGS 8 // rings of exited threads kept for new ones, any more are freed once drained
+#define LOG_FLUSH_INTERVAL 50 // milliseconds between writes of everything logged
+#define LOG_SINKS 4 // log files a single logger can write to
+
+
+// lines at or above a sink's level are written to it, LOG_EVAL lines are the ones used for later analysis
+enum LOG_LEVELS{LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_EVAL, LOG_NONE};
+
+
+// logger where every thread copies fixed-size records into a ring buffer of its own,
+// which a background thread drains and writes out in batches, so logging a line never
+// takes a lock, formats a stream or flushes a file on the thread doing the work
+class Logger {
+    private:
+        struct _record {
+            uint64_t time; // microseconds since the epoch
+            uint8_t sink;
+            uint8_t level;
+            uint8_t type_size;
+            uint8_t unused;
+            uint16_t msg_size;
+            char text[LOG_RECORD_SIZE - 14]; // type followed by the message
+        };
+        static_assert(sizeof(_record) == LOG_RECORD_SIZE, "log records must be LOG_RECORD_SIZE bytes");
+
+        // single producer, single consumer ring, only the owning thread moves tail and only the writer moves head
+        struct _ring {
+            _record records[LOG_RING_RECORDS];
+            std::atomic<uint64_t> head{0};
+            std::atomic<uint64_t> tail{0};
+            std::atomic<bool> owned{false}; // rings of threads which exited are handed to new threads
+        };
+
+        struct _sink {
+            int fd = -1;
+            int level = LOG_NONE;
+        };
+
+        _sink _sinks[LOG_SINKS];
+        int _sinks_count = 0;
+        int _stdout_level = LOG_NONE;
+
+        std::vector<std::shared_ptr<_ring>> _rings;
+        std::mutex _rings_m;
+
+        std::atomic<bool> _running{false};
+        std::atomic<bool> _wake{false}; // set by a thread whose ring is filling up, so the writer does not wait out the interval
+        std::thread _writer;
+        std::mutex _writer_m;
+        std::condition_variable _writer_cv;
+
+        // ring of the calling thread, taken from a thread which exited or created on its first line
+        _ring *ring() {
+            struct _owner {
+                Logger *logger = nullptr;
+                std::shared_ptr<_ring> ring;
+                ~_owner() { if (ring) ring->owned.store(false, std::memory_order_release); }
+            };
+            static thread_local _owner owner;
+            if (owner.logger != this) {
+                if (owner.ring)
+                    owner.ring->owned.store(false, std::memory_order_release);
+                owner.logger = this;
+                owner.ring = acquire_ring();
+            }
+            return owner.ring.get();
+        }
+
+        std::shared_ptr<_ring> acquire_ring() {
+            std::lock_guard<std::mutex> guard(_rings_m);
+            for (auto&& r : _rings) {
+                bool owned = false;
+                if (r->owned.compare_exchange_strong(owned, true, std::memory_order_acquire))
+                    return r;
+            }
+            _rings.push_back(std::make_shared<_ring>());
+            _rings.back()->owned = true;
+            return _rings.back();
+        }
+
+        // free drained rings of exited threads beyond the spares, so a burst of threads does not keep its rings forever
+        // a ring is only taken under the lock, so one seen unowned here is not handed out meanwhile
+        void free_spare_rings() {
+            std::lock_guard<std::mutex> guard(_rings_m);
+            int spare = 0;
+            for (auto it = _rings.begin(); it != _rings.end();) {
+                if ((*it)->owned.load(std::memory_order_acquire) ||
+                    (*it)->head.load(std::memory_order_relaxed) != (*it)->tail.load(std::memory_order_relaxed) ||
+                    ++spare <= LOG_SPARE_RINGS)
+                    it++;
+                else
+                    it = _rings.erase(it);
+            }
+        }
+
+        static void write_all(int fd, const std::string &data) {
+            size_t offset = 0;
+            while (offset < data.size()) {
+                ssize_t written = ::write(fd, data.data() + offset, data.size() - offset);
+                if (written < 0 && errno == EINTR)
+                    continue;
+                if (written <= 0)
+                    return;
+                offset += written;
+            }
+        }
+
+        // format a record the way lines were always written, eval lines keep their own '!' prefix
+        static void format(const _record &record, bool echo, std::string &out) {
+            if (record.level == LOG_EVAL)
+                out += "! [";
+            else {
+                char time[24];
+                out += '[';
+                out.append(time, snprintf(time, sizeof(time), "%llu", (unsigned long long)record.time));
+                out += "] [";
+            }
+            out.append(record.text, record.type_size);
+            out += (record.level == LOG_EVAL || echo) ? "] [" : "] ";
+            out.append(record.text + record.type_size, record.msg_size);
+            out += (record.level == LOG_EVAL || echo) ? "]\n\n" : "\n\n";
+        }
+
+        // move every waiting record out of the rings and write them in time order, one write per sink
+        void drain(std::vector<_record> &batch, std::vector<std::pair<uint64_t, size_t>> &order) {
+            std::vector<std::shared_ptr<_ring>> rings;
+            {
+                std::lock_guard<std::mutex> guard(_rings_m);
+                rings = _rings;
+            }
+            batch.clear();
+            for (auto&& r : rings) {
+                uint64_t head = r->head.load(std::memory_order_relaxed);
+                uint64_t tail = r->tail.load(std::memory_order_acquire);
+                for (; head < tail; head++)
+                    batch.push_back(r->records[head % LOG_RING_RECORDS]);
+                r->head.store(tail, std::memory_order_release);
+            }
+            free_spare_rings();
+            if (batch.empty())
+                return;
+            // every ring is already in order, only lines of different threads have to be interleaved
+            order.clear();
+            for (size_t i = 0; i < batch.size(); i++)
+                order.push_back({batch[i].time, i});
+            std::stable_sort(order.begin(), order.end());
+
+            std::string out[LOG_SINKS], echo;
+            for (auto&& x : order) {
+                const _record &record = batch[x.second];
+                if (record.level >= _sinks[record.sink].level)
+                    format(record, false, out[record.sink]);
+                if (record.level >= _stdout_level)
+                    format(record, true, echo);
+            }
+            for (int i = 0; i < _sinks_count; i++)
+                write_all(_sinks[i].fd, out[i]);
+            write_all(STDOUT_FILENO, echo);
+        }
+
+        void wake() {
+            std::lock_guard<std::mutex> guard(_writer_m);
+            _writer_cv.notify_one();
+        }
+
+        void run_writer() {
+            std::vector<_record> batch;
+            std::vector<std::pair<uint64_t, size_t>> order;
+            while (1) {
+                bool running;
+                {
+                    std::unique_lock<std::mutex> lock(_writer_m);
+                    _writer_cv.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL),
+                                        [this]{ return !_running || _wake.exchange(false); });
+                    running = _running;
+                }
+                drain(batch, order);
+                if (!running)
+                    return;
+            }
+        }
+
+    public:
+        // level named in a config file, or fallback if the name is unknown
+        static int level(const std::string &name, int fallback) {
+            const char *names[] = {"debug", "info", "warning", "eval", "none"};
+            for (int i = LOG_DEBUG; i <= LOG_NONE; i++) {
+                if (name == names[i])
+                    return i;
+            }
+            return fallback;
+        }
+
+        // open a log file written at or above level, returning the sink to log to or -1 on failure
+        // every sink is opened and the stdout level set before start
+        int open(const std::string &path, int level) {
+            if (_sinks_count == LOG_SINKS)
+                return -1;
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                return -1;
+            _sinks[_sinks_count].fd = fd;
+            _sinks[_sinks_count].level = level;
+            return _sinks_count++;
+        }
+
+        // echo lines at or above level to stdout, LOG_NONE turns the echo off
+        void echo(int level) {
+            _stdout_level = level;
+        }
+
+        void start() {
+            _running = true;
+            _writer = std::thread(&Logger::run_writer, this);
+        }
+
+        // write out everything logged so far and stop the writer, used before the process exits
+        void stop() {
+            {
+                std::lock_guard<std::mutex> guard(_writer_m);
+                if (!_running)
+                    return;
+                _running = false;
+            }
+            _writer_cv.notify_one();
+            _writer.join();
+        }
+
+        void write(int sink, int level, const std::string &type, const std::string &msg) {
+            // a sink which was never opened, or failed to open, is ignored
+            if (sink < 0 || sink >= _sinks_count || (level < _sinks[sink].level && level < _stdout_level))
+                return;
+            _ring *r = ring();
+            uint64_t tail = r->tail.load(std::memory_order_relaxed);
+            uint64_t waiting = tail - r->head.load(std::memory_order_acquire);
+            // wake the writer early once a ring is half full, instead of letting it fill up
+            if (waiting == LOG_RING_RECORDS / 2 && !_wake.exchange(true))
+                wake();
+            // lines are never dropped while the writer runs, a thread which gets a full ring ahead of it waits for it
+            while (waiting >= LOG_RING_RECORDS) {
+                if (!_running)
+                    return;
+                _wake = true;
+                wake();
+                std::this_thread::yield();
+                waiting = tail - r->head.load(std::memory_order_acquire);
+            }
+            _record &record = r->records[tail % LOG_RING_RECORDS];
+            record.time = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+            record.sink = sink;
+            record.level = level;
+            record.type_size = std::min(type.size(), sizeof(record.text));
+            record.msg_size = std::min(msg.size(), sizeof(record.text) - record.type_size);
+            memcpy(record.text, type.data(), record.type_size);
+            memcpy(record.text + record.type_size, msg.data(), record.msg_size);
+            r->tail.store(tail + 1, std::memory_order_release);
+        }
+
+        ~Logger() {
+            stop();
+            for (int i = 0; i < _sinks_count; i++)
+                close(_sinks[i].fd);
+        }
+};
+
+#endif
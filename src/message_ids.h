@@ -0,0 +1,94 @@
+#ifndef MESSAGE_IDS_H
+#define MESSAGE_IDS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+#define MESSAGE_IDS_SHARDS 16 // number of independently locked parts of the message ids table
+#define MESSAGE_ID_SLOTS 60 // seconds a message id is remembered, one wheel slot per second
+
+
+// message ids seen recently, used for dropping flooded messages which already passed through a peer
+// every shard keeps a timing wheel of the ids recorded in each second, so expiring a second
+// only touches the ids recorded in it and never scans the whole table
+class MessageIds {
+    private:
+        // splitmix64 finalizer, spreads ids whose ports and sequence numbers only differ in a few bits
+        struct _mix_hash {
+            size_t operator()(uint64_t key) const {
+                key ^= key >> 30;
+                key *= 0xbf58476d1ce4e5b9ULL;
+                key ^= key >> 27;
+                key *= 0x94d049bb133111ebULL;
+                key ^= key >> 31;
+                return key;
+            }
+        };
+
+        struct _shard {
+            std::mutex m;
+            std::unordered_map<uint64_t, uint64_t, _mix_hash> seen; // message id and the second it was recorded
+            std::vector<uint64_t> slots[MESSAGE_ID_SLOTS]; // ids recorded in each second of the wheel
+            uint64_t now = 0; // latest second the wheel has been advanced to
+        };
+        _shard _shards[MESSAGE_IDS_SHARDS];
+
+        static uint64_t key(int id, int sequence_number) {
+            return ((uint64_t)(uint32_t)id << 32) | (uint32_t)sequence_number;
+        }
+
+        // expire every slot the wheel passes on its way to the current second
+        // expects the shard's lock to be held
+        static void advance(_shard &s, uint64_t now) {
+            if (now <= s.now)
+                return;
+            uint64_t steps = std::min<uint64_t>(now - s.now, MESSAGE_ID_SLOTS);
+            for (uint64_t t = now - steps + 1; t <= now; t++) {
+                std::vector<uint64_t> &slot = s.slots[t % MESSAGE_ID_SLOTS];
+                for (auto&& k : slot)
+                    s.seen.erase(k);
+                slot.clear();
+            }
+            s.now = now;
+        }
+
+    public:
+        // the coarse clock is only as precise as the scheduler tick, which is plenty for one second slots
+        static uint64_t seconds_now() {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+            return ts.tv_sec;
+        }
+
+        // records a message id, returning false if it was already seen in the last MESSAGE_ID_SLOTS seconds
+        bool insert(int id, int sequence_number, uint64_t now=seconds_now()) {
+            uint64_t k = key(id, sequence_number);
+            _shard &s = _shards[_mix_hash()(k) % MESSAGE_IDS_SHARDS];
+            std::lock_guard<std::mutex> guard(s.m);
+            advance(s, now);
+            // most ids arrive once from every neighbor, so look up before paying for a new entry
+            if (s.seen.find(k) != s.seen.end())
+                return false;
+            s.seen.emplace(k, now);
+            s.slots[now % MESSAGE_ID_SLOTS].push_back(k);
+            return true;
+        }
+
+        // visit every remembered message id
+        void for_each(std::function<void(int, int)> f) {
+            for (auto&& s : _shards) {
+                std::lock_guard<std::mutex> guard(s.m);
+                for (auto const &x : s.seen)
+                    f((int)(x.first >> 32), (int)(uint32_t)x.first);
+            }
+        }
+};
+
+#endif
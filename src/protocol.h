@@ -0,0 +1,653 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+
+#define MAX_FILENAME_SIZE 256 // assume the maximum file size is 256 characters
+#define MAX_MSG_SIZE 4096
+#define MAX_STAT_MSG_SIZE 16
+#define MAX_FRAME_SIZE (16 * 1024 * 1024) // reject anything larger as a corrupt frame
+#define FRAME_HEADER_SIZE 5 // 1 byte message type followed by a 4 byte payload length
+#define IO_TIMEOUT 5000 // milliseconds to wait on a non-blocking socket before giving up on a message
+#define MAX_RANGE_SIZE (8 * 1024 * 1024) // largest byte range of a file a node server reads into memory to checksum
+
+
+// framed messages carry a type and length header, legacy messages are the original fixed-size fields
+enum WIRE_FORMATS{FRAMED, LEGACY};
+
+// every message sent between super peers and leaf nodes
+enum MESSAGE_TYPES{
+    // first message on a connection to a super peer
+    NODE_CONNECT = 1, PEER_QUERY, PEER_INVALIDATE, PEER_COMPARE, PEER_LINK_CONNECT,
+    // requests from a connected leaf node to its super peer
+    REGISTRY, DEREGISTRY, SEARCH, PRINT_FILES_INDEX, PRINT_MESSAGE_IDS, PRINT_MODIFIED_FILES, NODE_DISCONNECT,
+    // requests on a pooled link between super peers
+    LINK_QUERY, LINK_INVALIDATE, LINK_COMPARE,
+    // first message on a connection to a leaf node
+    NODE_INVALIDATE, OBTAIN, POLL,
+    // replies
+    SEARCH_REPLY, PEER_REPLY, LINK_REPLY, OBTAIN_REPLY, POLL_REPLY,
+    // routing summary pushed to a neighbor over a pooled link
+    LINK_SUMMARY,
+    // registrations of a leaf node's cached copy of a file from another node
+    REMOTE_REGISTRY, REMOTE_DEREGISTRY,
+    // invalidations gathered over a short window and sent to a destination together
+    NODE_INVALIDATE_BATCH, LINK_INVALIDATE_BATCH,
+    // a leaf node's registration changes since its last acknowledged batch, and the acknowledgement
+    REGISTRY_BATCH, REGISTRY_ACK,
+    // a byte range of a file and its checksum, so a download can be spread over every node holding the file
+    OBTAIN_RANGE, OBTAIN_RANGE_REPLY,
+    // part of a file from an offset, so an interrupted download continues where it stopped
+    OBTAIN_PART, OBTAIN_PART_REPLY,
+    // first message on a connection to a leaf node which carries a pipeline of requests, answered in order
+    LEAF_SESSION,
+    // a file sent as the changes to the blocks of an old copy, so refreshing a copy only sends what changed
+    OBTAIN_DELTA, OBTAIN_DELTA_REPLY
+};
+
+// which messages may be received at a point of a conversation
+enum CHANNELS{SUPER_PEER_CONNECTION, NODE_LINK, PEER_LINK, LEAF_NODE_CONNECTION, REPLY};
+
+enum RECV_STATUS{MSG_OK, MSG_NONE, MSG_CLOSED, MSG_ERROR};
+
+enum FIELDS{F_REQUEST_ID, F_TTL, F_ID, F_SEQUENCE_NUMBER, F_FILENAME, F_VERSION,
+            F_MESSAGE_ID, F_MESSAGE_SEQUENCE_NUMBER, F_TEXT, F_SIZE, F_VALID, F_OFFSET, F_CHECKSUM, F_HASH, F_CODEC};
+
+
+// fields of any message, each message type only uses the fields listed in its schema
+struct message {
+    int type = 0;
+    uint32_t request_id = 0; // matches replies to requests on a pooled link
+    int ttl = 0;
+    int id = 0; // node or origin node the message is about
+    int sequence_number = 0;
+    std::string filename;
+    time_t version = 0;
+    int message_id = 0; // id part of the message id used for dropping duplicates
+    int message_sequence_number = 0; // sequence number part of the message id
+    std::string text; // comma delimited ids for search results
+    int64_t size = 0; // file size for obtain replies, negative on failure
+    bool valid = false;
+    int64_t offset = 0; // start of a byte range of a file
+    uint64_t checksum = 0; // checksum of the byte range sent after a range reply
+    uint64_t hash = 0; // content hash of the whole file, 0 if unknown
+    int codec = 0; // compression a request accepts for the file following its reply, or the reply was sent with
+};
+
+
+#define HASH_PRIME1 11400714785074694791ULL
+#define HASH_PRIME2 14029467366897019727ULL
+#define HASH_PRIME3 1609587929392839161ULL
+#define HASH_PRIME4 9650029242287828579ULL
+#define HASH_PRIME5 2870177450012600261ULL
+
+inline uint64_t hash_rotate(uint64_t x, int bits) {
+    return (x << bits) | (x >> (64 - bits));
+}
+
+inline uint64_t hash_round(uint64_t acc, uint64_t word) {
+    return hash_rotate(acc + word * HASH_PRIME2, 31) * HASH_PRIME1;
+}
+
+inline uint64_t hash_merge(uint64_t acc, uint64_t lane) {
+    return (acc ^ hash_round(0, lane)) * HASH_PRIME1 + HASH_PRIME4;
+}
+
+// 64 bit hash of a byte range, xxHash64, used for the checksum of a range reply, the strong checksum of a delta block
+// and the content hash of a file
+// every bit of the input reaches every bit of the hash, so two different ranges share a hash with a chance of about
+// 2^-64, which is all a changed file or a damaged transfer relies on, it is not meant to stand up to a node crafting
+// collisions on purpose
+inline uint64_t range_checksum(const char *data, size_t size, uint64_t seed=0) {
+    const char *end = data + size;
+    uint64_t hash, word;
+    if (size >= 32) {
+        uint64_t lanes[4] = {seed + HASH_PRIME1 + HASH_PRIME2, seed + HASH_PRIME2, seed, seed - HASH_PRIME1};
+        for (; data + 32 <= end; data += 32) {
+            for (int i = 0; i < 4; i++) {
+                memcpy(&word, data + i * 8, sizeof(word));
+                lanes[i] = hash_round(lanes[i], word);
+            }
+        }
+        hash = hash_rotate(lanes[0], 1) + hash_rotate(lanes[1], 7) + hash_rotate(lanes[2], 12) + hash_rotate(lanes[3], 18);
+        for (int i = 0; i < 4; i++)
+            hash = hash_merge(hash, lanes[i]);
+    }
+    else
+        hash = seed + HASH_PRIME5;
+    hash += size;
+    for (; data + 8 <= end; data += 8) {
+        memcpy(&word, data, sizeof(word));
+        hash = hash_rotate(hash ^ hash_round(0, word), 27) * HASH_PRIME1 + HASH_PRIME4;
+    }
+    if (data + 4 <= end) {
+        uint32_t half;
+        memcpy(&half, data, sizeof(half));
+        hash = hash_rotate(hash ^ (half * HASH_PRIME1), 23) * HASH_PRIME2 + HASH_PRIME3;
+        data += 4;
+    }
+    for (; data < end; data++)
+        hash = hash_rotate(hash ^ ((unsigned char)*data * HASH_PRIME5), 11) * HASH_PRIME1;
+    // final avalanche, so the last bytes spread over the whole hash too
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// layout of a message type in both wire formats
+struct message_schema {
+    int type;
+    int channel;
+    const char *legacy_prefix; // request characters which identify the message in the legacy format
+    std::vector<int> fields;
+};
+
+
+class Protocol {
+    private:
+        // helper function for looking up the layout of a message type
+        const message_schema *schema(int type) {
+            static const std::vector<message_schema> schemas = {
+                {NODE_CONNECT, SUPER_PEER_CONNECTION, "1", {F_ID}},
+                {PEER_QUERY, SUPER_PEER_CONNECTION, "01", {F_TTL, F_ID, F_SEQUENCE_NUMBER, F_FILENAME,
+                                                           F_MESSAGE_ID, F_MESSAGE_SEQUENCE_NUMBER}},
+                // content hashes are only sent framed, legacy messages leave them 0 and files are compared by version
+                {PEER_INVALIDATE, SUPER_PEER_CONNECTION, "02", {F_TTL, F_ID, F_SEQUENCE_NUMBER, F_FILENAME, F_VERSION,
+                                                                F_MESSAGE_ID, F_MESSAGE_SEQUENCE_NUMBER, F_HASH}},
+                {PEER_COMPARE, SUPER_PEER_CONNECTION, "03", {F_TTL, F_ID, F_SEQUENCE_NUMBER, F_FILENAME, F_VERSION,
+                                                             F_MESSAGE_ID, F_MESSAGE_SEQUENCE_NUMBER, F_HASH}},
+                {PEER_LINK_CONNECT, SUPER_PEER_CONNECTION, "2", {}},
+                {REGISTRY, NODE_LINK, "1", {F_FILENAME}},
+                {DEREGISTRY, NODE_LINK, "2", {F_FILENAME, F_VERSION, F_HASH}},
+                {SEARCH, NODE_LINK, "3", {F_FILENAME}},
+                {PRINT_FILES_INDEX, NODE_LINK, "4", {}},
+                {PRINT_MESSAGE_IDS, NODE_LINK, "5", {}},
+                {PRINT_MODIFIED_FILES, NODE_LINK, "6", {}},
+                {NODE_DISCONNECT, NODE_LINK, "0", {}},
+                {LINK_QUERY, PEER_LINK, "1", {F_REQUEST_ID, F_TTL, F_ID, F_SEQUENCE_NUMBER, F_FILENAME,
+                                              F_MESSAGE_ID, F_MESSAGE_SEQUENCE_NUMBER}},
+                {LINK_INVALIDATE, PEER_LINK, "2", {F_REQUEST_ID, F_TTL, F_ID, F_SEQUENCE_NUMBER, F_FILENAME, F_VERSION,
+                                                   F_MESSAGE_ID, F_MESSAGE_SEQUENCE_NUMBER, F_HASH}},
+                {LINK_COMPARE, PEER_LINK, "3", {F_REQUEST_ID, F_TTL, F_ID, F_SEQUENCE_NUMBER, F_FILENAME, F_VERSION,
+                                                F_MESSAGE_ID, F_MESSAGE_SEQUENCE_NUMBER, F_HASH}},
+                {NODE_INVALIDATE, LEAF_NODE_CONNECTION, "0", {F_ID, F_FILENAME, F_VERSION, F_HASH}},
+                {OBTAIN, LEAF_NODE_CONNECTION, "11", {F_FILENAME}},
+                {POLL, LEAF_NODE_CONNECTION, "12", {F_FILENAME, F_VERSION, F_HASH}},
+                {SEARCH_REPLY, REPLY, "", {F_TEXT}},
+                {PEER_REPLY, REPLY, "", {F_TEXT}},
+                {LINK_REPLY, REPLY, "", {F_REQUEST_ID, F_TEXT}},
+                // the origin and version are only sent when the file could be read
+                {OBTAIN_REPLY, REPLY, "", {F_SIZE, F_ID, F_VERSION, F_HASH}},
+                {POLL_REPLY, REPLY, "", {F_VALID}},
+                // summaries do not fit the legacy format's fixed-size text, so they are only sent framed
+                {LINK_SUMMARY, PEER_LINK, "", {F_ID, F_TEXT}},
+                // subscriptions are only sent framed, legacy nodes register cached copies as plain files the way they always did
+                {REMOTE_REGISTRY, NODE_LINK, "", {F_ID, F_FILENAME}},
+                {REMOTE_DEREGISTRY, NODE_LINK, "", {F_ID, F_FILENAME}},
+                // batches carry whole framed messages in their text, so they are only sent framed
+                {NODE_INVALIDATE_BATCH, LEAF_NODE_CONNECTION, "", {F_TEXT}},
+                {LINK_INVALIDATE_BATCH, PEER_LINK, "", {F_TEXT}},
+                {REGISTRY_BATCH, NODE_LINK, "", {F_REQUEST_ID, F_TEXT}},
+                {REGISTRY_ACK, REPLY, "", {F_REQUEST_ID}},
+                // ranges are only sent framed, the size of a range reply is the size of the whole file
+                {OBTAIN_RANGE, LEAF_NODE_CONNECTION, "", {F_FILENAME, F_OFFSET, F_SIZE}},
+                {OBTAIN_RANGE_REPLY, REPLY, "", {F_SIZE, F_ID, F_VERSION, F_CHECKSUM, F_HASH}},
+                // a part request names the origin and version of the partial copy, the reply says where the data starts
+                {OBTAIN_PART, LEAF_NODE_CONNECTION, "", {F_FILENAME, F_ID, F_VERSION, F_OFFSET, F_SIZE, F_CODEC}},
+                {OBTAIN_PART_REPLY, REPLY, "", {F_SIZE, F_ID, F_VERSION, F_OFFSET, F_HASH, F_CODEC}},
+                {LEAF_SESSION, LEAF_NODE_CONNECTION, "", {}},
+                // the size of a delta request is the block size its signatures were made with
+                {OBTAIN_DELTA, LEAF_NODE_CONNECTION, "", {F_FILENAME, F_SIZE, F_TEXT}},
+                {OBTAIN_DELTA_REPLY, REPLY, "", {F_SIZE, F_ID, F_VERSION, F_HASH}},
+            };
+            for (auto&& x : schemas) {
+                if (x.type == type)
+                    return &x;
+            }
+            return nullptr;
+        }
+
+        // obtain replies stop after the size when the file could not be read
+        static bool failed_obtain(const message &msg) {
+            return (msg.type == OBTAIN_REPLY || msg.type == OBTAIN_RANGE_REPLY || msg.type == OBTAIN_PART_REPLY ||
+                    msg.type == OBTAIN_DELTA_REPLY) && msg.size < 0;
+        }
+
+        // waits until a non-blocking socket is ready for the given events
+        bool wait_socket(int socket_fd, short events) {
+            struct pollfd pfd = {socket_fd, events, 0};
+            return poll(&pfd, 1, IO_TIMEOUT) > 0;
+        }
+
+        template<typename T>
+        void append(std::string &data, const T &value) {
+            data.append((const char *)&value, sizeof(value));
+        }
+
+        // copy a string into a zero padded fixed-size legacy field, truncating if needed
+        void append_fixed(std::string &data, const std::string &value, size_t size) {
+            size_t length = std::min(value.size(), size - 1);
+            data.append(value.data(), length);
+            data.append(size - length, '\0');
+        }
+
+        // encode the fields of a message into the payload of a frame
+        void encode_framed(const message &msg, const message_schema &s, std::string &data) {
+            for (auto&& field : s.fields) {
+                switch (field) {
+                    case F_REQUEST_ID: append(data, htonl(msg.request_id)); break;
+                    case F_TTL: append(data, htonl((uint32_t)msg.ttl)); break;
+                    case F_ID: append(data, htonl((uint32_t)msg.id)); break;
+                    case F_SEQUENCE_NUMBER: append(data, htonl((uint32_t)msg.sequence_number)); break;
+                    case F_MESSAGE_ID: append(data, htonl((uint32_t)msg.message_id)); break;
+                    case F_MESSAGE_SEQUENCE_NUMBER: append(data, htonl((uint32_t)msg.message_sequence_number)); break;
+                    case F_VERSION: append(data, htobe64((uint64_t)msg.version)); break;
+                    case F_SIZE:
+                        append(data, htobe64((uint64_t)msg.size));
+                        if (failed_obtain(msg))
+                            return;
+                        break;
+                    case F_VALID: data += (char)msg.valid; break;
+                    case F_CODEC: data += (char)msg.codec; break;
+                    case F_OFFSET: append(data, htobe64((uint64_t)msg.offset)); break;
+                    case F_CHECKSUM: append(data, htobe64(msg.checksum)); break;
+                    case F_HASH: append(data, htobe64(msg.hash)); break;
+                    case F_FILENAME:
+                        append(data, htons((uint16_t)msg.filename.size()));
+                        data += msg.filename;
+                        break;
+                    case F_TEXT:
+                        append(data, htonl((uint32_t)msg.text.size()));
+                        data += msg.text;
+                        break;
+                }
+            }
+        }
+
+        // helper for reading a fixed size value out of a frame payload
+        template<typename T>
+        bool take(const std::string &data, size_t &offset, T &value) {
+            if (offset + sizeof(value) > data.size())
+                return false;
+            memcpy(&value, data.data() + offset, sizeof(value));
+            offset += sizeof(value);
+            return true;
+        }
+
+        bool decode_framed(const std::string &data, const message_schema &s, message &msg) {
+            size_t offset = 0;
+            uint32_t value;
+            uint64_t wide_value;
+            uint16_t name_size;
+            for (auto&& field : s.fields) {
+                switch (field) {
+                    case F_REQUEST_ID:
+                        if (!take(data, offset, value)) return false;
+                        msg.request_id = ntohl(value);
+                        break;
+                    case F_TTL:
+                        if (!take(data, offset, value)) return false;
+                        msg.ttl = (int)ntohl(value);
+                        break;
+                    case F_ID:
+                        if (!take(data, offset, value)) return false;
+                        msg.id = (int)ntohl(value);
+                        break;
+                    case F_SEQUENCE_NUMBER:
+                        if (!take(data, offset, value)) return false;
+                        msg.sequence_number = (int)ntohl(value);
+                        break;
+                    case F_MESSAGE_ID:
+                        if (!take(data, offset, value)) return false;
+                        msg.message_id = (int)ntohl(value);
+                        break;
+                    case F_MESSAGE_SEQUENCE_NUMBER:
+                        if (!take(data, offset, value)) return false;
+                        msg.message_sequence_number = (int)ntohl(value);
+                        break;
+                    case F_VERSION:
+                        if (!take(data, offset, wide_value)) return false;
+                        msg.version = (time_t)be64toh(wide_value);
+                        break;
+                    case F_SIZE:
+                        if (!take(data, offset, wide_value)) return false;
+                        msg.size = (int64_t)be64toh(wide_value);
+                        if (failed_obtain(msg))
+                            return true;
+                        break;
+                    case F_VALID:
+                        if (offset + 1 > data.size()) return false;
+                        msg.valid = data[offset++] != 0;
+                        break;
+                    case F_CODEC:
+                        if (offset + 1 > data.size()) return false;
+                        msg.codec = (unsigned char)data[offset++];
+                        break;
+                    case F_OFFSET:
+                        if (!take(data, offset, wide_value)) return false;
+                        msg.offset = (int64_t)be64toh(wide_value);
+                        break;
+                    case F_CHECKSUM:
+                        if (!take(data, offset, wide_value)) return false;
+                        msg.checksum = be64toh(wide_value);
+                        break;
+                    case F_HASH:
+                        if (!take(data, offset, wide_value)) return false;
+                        msg.hash = be64toh(wide_value);
+                        break;
+                    case F_FILENAME:
+                        if (!take(data, offset, name_size)) return false;
+                        name_size = ntohs(name_size);
+                        if (offset + name_size > data.size()) return false;
+                        msg.filename = data.substr(offset, name_size);
+                        offset += name_size;
+                        break;
+                    case F_TEXT:
+                        if (!take(data, offset, value)) return false;
+                        value = ntohl(value);
+                        if (offset + value > data.size()) return false;
+                        msg.text = data.substr(offset, value);
+                        offset += value;
+                        break;
+                }
+            }
+            return true;
+        }
+
+        // send each field on its own the way the original protocol did
+        bool send_legacy(int socket_fd, const message &msg, const message_schema &s) {
+            for (const char *c = s.legacy_prefix; *c; c++) {
+                if (!send_all(socket_fd, c, sizeof(char)))
+                    return false;
+            }
+            for (auto&& field : s.fields) {
+                std::string data;
+                switch (field) {
+                    case F_REQUEST_ID: append(data, msg.request_id); break;
+                    case F_TTL: append(data, msg.ttl); break;
+                    case F_ID: append(data, msg.id); break;
+                    case F_SEQUENCE_NUMBER: append(data, msg.sequence_number); break;
+                    case F_MESSAGE_ID: append(data, msg.message_id); break;
+                    case F_MESSAGE_SEQUENCE_NUMBER: append(data, msg.message_sequence_number); break;
+                    case F_VERSION: append(data, msg.version); break;
+                    case F_VALID: append(data, msg.valid); break;
+                    case F_FILENAME: append_fixed(data, msg.filename, MAX_FILENAME_SIZE); break;
+                    case F_TEXT: append_fixed(data, msg.text, MAX_MSG_SIZE); break;
+                    case F_SIZE:
+                        append_fixed(data, std::to_string(msg.size), MAX_STAT_MSG_SIZE);
+                        break;
+                }
+                if (!send_all(socket_fd, data.data(), data.size()))
+                    return false;
+                if (field == F_SIZE && failed_obtain(msg))
+                    break;
+            }
+            return true;
+        }
+
+        bool recv_legacy_fields(int socket_fd, const message_schema &s, message &msg) {
+            char buffer[MAX_MSG_SIZE];
+            for (auto&& field : s.fields) {
+                switch (field) {
+                    case F_REQUEST_ID:
+                        if (!recv_all(socket_fd, &msg.request_id, sizeof(msg.request_id))) return false;
+                        break;
+                    case F_TTL:
+                        if (!recv_all(socket_fd, &msg.ttl, sizeof(msg.ttl))) return false;
+                        break;
+                    case F_ID:
+                        if (!recv_all(socket_fd, &msg.id, sizeof(msg.id))) return false;
+                        break;
+                    case F_SEQUENCE_NUMBER:
+                        if (!recv_all(socket_fd, &msg.sequence_number, sizeof(msg.sequence_number))) return false;
+                        break;
+                    case F_MESSAGE_ID:
+                        if (!recv_all(socket_fd, &msg.message_id, sizeof(msg.message_id))) return false;
+                        break;
+                    case F_MESSAGE_SEQUENCE_NUMBER:
+                        if (!recv_all(socket_fd, &msg.message_sequence_number, sizeof(msg.message_sequence_number)))
+                            return false;
+                        break;
+                    case F_VERSION:
+                        if (!recv_all(socket_fd, &msg.version, sizeof(msg.version))) return false;
+                        break;
+                    case F_VALID:
+                        if (!recv_all(socket_fd, &msg.valid, sizeof(msg.valid))) return false;
+                        break;
+                    case F_FILENAME:
+                        if (!recv_all(socket_fd, buffer, MAX_FILENAME_SIZE)) return false;
+                        buffer[MAX_FILENAME_SIZE - 1] = '\0';
+                        msg.filename = buffer;
+                        break;
+                    case F_TEXT:
+                        if (!recv_all(socket_fd, buffer, MAX_MSG_SIZE)) return false;
+                        buffer[MAX_MSG_SIZE - 1] = '\0';
+                        msg.text = buffer;
+                        break;
+                    case F_SIZE:
+                        if (!recv_all(socket_fd, buffer, MAX_STAT_MSG_SIZE)) return false;
+                        buffer[MAX_STAT_MSG_SIZE - 1] = '\0';
+                        msg.size = strtoll(buffer, nullptr, 10);
+                        if (failed_obtain(msg))
+                            return true;
+                        break;
+                }
+            }
+            return true;
+        }
+
+        // read the start of a message, up to size bytes, telling apart a closed socket and a spurious wakeup from an error
+        int recv_first(int socket_fd, char *buffer, size_t size, size_t &received) {
+            ssize_t received_size;
+            while ((received_size = recv(socket_fd, buffer, size, 0)) < 0 && errno == EINTR);
+            recv_calls++;
+            if (received_size == 0)
+                return MSG_CLOSED;
+            if (received_size < 0)
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? MSG_NONE : MSG_ERROR;
+            bytes_received += received_size;
+            received = received_size;
+            return MSG_OK;
+        }
+
+    public:
+        int wire_format = FRAMED;
+
+        // totals used for comparing the wire formats
+        std::atomic<uint64_t> bytes_sent{0};
+        std::atomic<uint64_t> bytes_received{0};
+        std::atomic<uint64_t> send_calls{0};
+        std::atomic<uint64_t> recv_calls{0};
+
+        // receive exactly size bytes, handling partial reads and non-blocking sockets
+        bool recv_all(int socket_fd, void *buffer, size_t size) {
+            char *data = (char *)buffer;
+            while (size > 0) {
+                ssize_t received_size = recv(socket_fd, data, size, 0);
+                recv_calls++;
+                if (received_size > 0) {
+                    bytes_received += received_size;
+                    data += received_size;
+                    size -= received_size;
+                }
+                else if (received_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    if (!wait_socket(socket_fd, POLLIN))
+                        return false;
+                }
+                else if (received_size < 0 && errno == EINTR)
+                    continue;
+                else
+                    return false; // connection closed or failed
+            }
+            return true;
+        }
+
+        // send exactly size bytes, handling partial writes and non-blocking sockets
+        bool send_all(int socket_fd, const void *buffer, size_t size) {
+            const char *data = (const char *)buffer;
+            while (size > 0) {
+                ssize_t sent_size = send(socket_fd, data, size, MSG_NOSIGNAL);
+                send_calls++;
+                if (sent_size > 0) {
+                    bytes_sent += sent_size;
+                    data += sent_size;
+                    size -= sent_size;
+                }
+                else if (sent_size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    if (!wait_socket(socket_fd, POLLOUT))
+                        return false;
+                }
+                else if (sent_size < 0 && errno == EINTR)
+                    continue;
+                else
+                    return false;
+            }
+            return true;
+        }
+
+        // encode a whole frame, header included, so it can be written with a single send
+        std::string encode(const message &msg) {
+            const message_schema *s = schema(msg.type);
+            std::string data(FRAME_HEADER_SIZE, '\0');
+            encode_framed(msg, *s, data);
+            data[0] = (char)msg.type;
+            uint32_t length = htonl((uint32_t)(data.size() - FRAME_HEADER_SIZE));
+            memcpy(&data[1], &length, sizeof(length));
+            return data;
+        }
+
+        // frames of several messages back to back, used as the text of a batch message
+        std::string encode_batch(const std::vector<message> &msgs) {
+            std::string data;
+            for (auto&& msg : msgs)
+                data += encode(msg);
+            return data;
+        }
+
+        // split the text of a batch message back into its messages, returning false if a frame is malformed
+        bool decode_batch(const std::string &data, std::vector<message> &msgs) {
+            size_t offset = 0;
+            while (offset < data.size()) {
+                if (offset + FRAME_HEADER_SIZE > data.size())
+                    return false;
+                uint32_t length;
+                memcpy(&length, data.data() + offset + 1, sizeof(length));
+                length = ntohl(length);
+                const message_schema *s = schema((unsigned char)data[offset]);
+                if (s == nullptr || length > data.size() - offset - FRAME_HEADER_SIZE)
+                    return false;
+                message msg;
+                msg.type = s->type;
+                if (!decode_framed(data.substr(offset + FRAME_HEADER_SIZE, length), *s, msg))
+                    return false;
+                msgs.push_back(msg);
+                offset += FRAME_HEADER_SIZE + length;
+            }
+            return true;
+        }
+
+        // write a message in the configured wire format
+        bool send_message(int socket_fd, const message &msg) {
+            const message_schema *s = schema(msg.type);
+            if (s == nullptr)
+                return false;
+            if (wire_format == LEGACY)
+                return send_legacy(socket_fd, msg, *s);
+            std::string data = encode(msg);
+            return send_all(socket_fd, data.data(), data.size());
+        }
+
+        // read the next request allowed on a channel
+        // returns MSG_NONE if a non-blocking socket had nothing to read yet and MSG_CLOSED on an orderly shutdown
+        int recv_message(int socket_fd, int channel, message &msg) {
+            msg = message();
+            // the header is read in full before the payload so nothing past the frame is consumed
+            char header[FRAME_HEADER_SIZE];
+            size_t received = 0;
+            int status = recv_first(socket_fd, header, (wire_format == LEGACY) ? 1 : FRAME_HEADER_SIZE, received);
+            if (status != MSG_OK)
+                return status;
+
+            if (wire_format == LEGACY) {
+                char first = header[0];
+                // read request characters until they name a single message type of the channel
+                std::string prefix(1, first);
+                while (1) {
+                    const message_schema *match = nullptr;
+                    bool longer = false;
+                    for (int type = NODE_CONNECT; schema(type) != nullptr; type++) {
+                        const message_schema *s = schema(type);
+                        if (s->channel != channel || !*s->legacy_prefix || strncmp(s->legacy_prefix, prefix.c_str(), prefix.size()) != 0)
+                            continue;
+                        if (strlen(s->legacy_prefix) == prefix.size())
+                            match = s;
+                        else
+                            longer = true;
+                    }
+                    if (match != nullptr) {
+                        msg.type = match->type;
+                        return recv_legacy_fields(socket_fd, *match, msg) ? MSG_OK : MSG_ERROR;
+                    }
+                    if (!longer || !recv_all(socket_fd, &first, sizeof(first)))
+                        return MSG_ERROR;
+                    prefix += first;
+                }
+            }
+
+            if (received < FRAME_HEADER_SIZE && !recv_all(socket_fd, header + received, FRAME_HEADER_SIZE - received))
+                return MSG_ERROR;
+            uint32_t length;
+            memcpy(&length, header + 1, sizeof(length));
+            length = ntohl(length);
+            const message_schema *s = schema((unsigned char)header[0]);
+            if (s == nullptr || s->channel != channel || length > MAX_FRAME_SIZE)
+                return MSG_ERROR;
+
+            std::string data(length, '\0');
+            if (length > 0 && !recv_all(socket_fd, &data[0], length))
+                return MSG_ERROR;
+            msg.type = s->type;
+            return decode_framed(data, *s, msg) ? MSG_OK : MSG_ERROR;
+        }
+
+        // read a reply of a known type
+        bool recv_reply(int socket_fd, int type, message &msg) {
+            msg = message();
+            msg.type = type;
+            const message_schema *s = schema(type);
+            if (wire_format == LEGACY)
+                return recv_legacy_fields(socket_fd, *s, msg);
+
+            char header[FRAME_HEADER_SIZE];
+            if (!recv_all(socket_fd, header, FRAME_HEADER_SIZE) || (unsigned char)header[0] != type)
+                return false;
+            uint32_t length;
+            memcpy(&length, header + 1, sizeof(length));
+            length = ntohl(length);
+            if (length > MAX_FRAME_SIZE)
+                return false;
+
+            std::string data(length, '\0');
+            if (length > 0 && !recv_all(socket_fd, &data[0], length))
+                return false;
+            return decode_framed(data, *s, msg);
+        }
+};
+
+#endif
@@ -0,0 +1,284 @@
+#ifndef REMOTE_FILES_H
+#define REMOTE_FILES_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// copies of other nodes' files cached in a leaf node's remote files directory
+// indexed by the origin node and name of the file and by the name it is saved under,
+// so every lookup of a request is a hash lookup, and every access holds the table's lock
+// valid copies are kept within a byte budget, the least recently used ones are evicted first once it is exceeded
+// stale copies and part files left by interrupted downloads count against the budget too, and are evicted before any copy
+class RemoteFiles {
+    public:
+        struct file {
+            std::string local_name; // name of the saved file in the current node's directory
+            std::string origin_name; // name of the file from the origin server
+            int origin_node; // the origin server's id
+            time_t version; // version number of the remote file
+            std::chrono::time_point<std::chrono::system_clock> check_time; // last time the file's consistency was checked
+            bool valid; // flag for if a file is valid (consistent) or has been removed
+            uint64_t hash; // content hash of the origin node's file, 0 if unknown
+            int64_t size; // bytes the copy takes in the remote files directory
+            int ttr; // seconds between checks of the copy's consistency with its origin node
+        };
+
+    private:
+        typedef std::pair<int, std::string> _key; // origin node and name of a file
+
+        struct _key_hash {
+            size_t operator()(const _key &key) const {
+                return std::hash<std::string>()(key.second) * 31 + std::hash<int>()(key.first);
+            }
+        };
+
+        std::mutex _m;
+        std::unordered_map<_key, file, _key_hash> _files;
+        std::unordered_map<std::string, _key> _local_names; // name each file is saved under
+        std::list<_key> _used; // valid files, most recently used first
+        std::unordered_map<_key, std::list<_key>::iterator, _key_hash> _positions; // place of each valid file in _used
+        int64_t _bytes = 0; // size of every valid file
+        int64_t _budget = 0; // most bytes valid files and leftovers may take, 0 if there is no limit
+
+        // stale copies and part files kept only so a later refresh or obtain downloads less, by name, oldest last
+        std::list<std::pair<std::string, int64_t>> _leftovers;
+        std::unordered_map<std::string, std::list<std::pair<std::string, int64_t>>::iterator> _leftover_positions;
+        int64_t _leftover_bytes = 0;
+
+        // stop counting a file against the budget, once it is invalid or evicted
+        void release(std::unordered_map<_key, file, _key_hash>::iterator it) {
+            auto position = _positions.find(it->first);
+            if (position == _positions.end())
+                return;
+            _used.erase(position->second);
+            _positions.erase(position);
+            _bytes -= it->second.size;
+        }
+
+        // move a valid file to the front of the used order
+        void use(const _key &key) {
+            auto position = _positions.find(key);
+            if (position != _positions.end())
+                _used.splice(_used.begin(), _used, position->second);
+        }
+
+    public:
+        // requests served from a cached copy, downloads into the cache and copies evicted to stay within the budget
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> evictions{0};
+
+        void set_budget(int64_t budget) {
+            std::lock_guard<std::mutex> guard(_m);
+            _budget = budget;
+        }
+
+        int64_t budget() {
+            std::lock_guard<std::mutex> guard(_m);
+            return _budget;
+        }
+
+        int64_t bytes() {
+            std::lock_guard<std::mutex> guard(_m);
+            return _bytes + _leftover_bytes;
+        }
+
+        // count a stale copy or part file saved under a name against the budget, replacing its previous size
+        void keep_leftover(const std::string &name, int64_t size) {
+            std::lock_guard<std::mutex> guard(_m);
+            auto it = _leftover_positions.find(name);
+            if (it != _leftover_positions.end()) {
+                _leftover_bytes -= it->second->second;
+                _leftovers.erase(it->second);
+            }
+            _leftovers.push_front({name, size});
+            _leftover_positions[name] = _leftovers.begin();
+            _leftover_bytes += size;
+        }
+
+        // stop counting a stale copy or part file once it is used up or deleted
+        void drop_leftover(const std::string &name) {
+            std::lock_guard<std::mutex> guard(_m);
+            auto it = _leftover_positions.find(name);
+            if (it == _leftover_positions.end())
+                return;
+            _leftover_bytes -= it->second->second;
+            _leftovers.erase(it->second);
+            _leftover_positions.erase(it);
+        }
+
+        // copy of a file from its origin node, which may have been invalidated since
+        bool find(int origin, const std::string &origin_name, file &found) {
+            std::lock_guard<std::mutex> guard(_m);
+            auto it = _files.find(_key(origin, origin_name));
+            if (it == _files.end())
+                return false;
+            found = it->second;
+            return true;
+        }
+
+        // copy of the file saved under a name in the remote files directory
+        bool find_local(const std::string &local_name, file &found) {
+            std::lock_guard<std::mutex> guard(_m);
+            auto it = _local_names.find(local_name);
+            if (it == _local_names.end())
+                return false;
+            found = _files[it->second];
+            return true;
+        }
+
+        // copy of the file saved under a name which is about to be sent to another node, counted as a hit
+        bool serve_local(const std::string &local_name, file &found) {
+            std::lock_guard<std::mutex> guard(_m);
+            auto it = _local_names.find(local_name);
+            if (it == _local_names.end())
+                return false;
+            found = _files[it->second];
+            use(it->second);
+            hits++;
+            return true;
+        }
+
+        // true if a file from another origin node is already saved under the name
+        bool local_name_taken(const std::string &local_name, int origin) {
+            std::lock_guard<std::mutex> guard(_m);
+            auto it = _local_names.find(local_name);
+            return it != _local_names.end() && it->second.first != origin;
+        }
+
+        // add a downloaded file, or update the version of a copy already cached
+        // the oldest leftovers are evicted into evicted_leftovers, then the least recently used copies into evicted,
+        // until the files fit the budget, the new copy is always kept
+        // returns false if the file was already cached, in which case its saved name is kept
+        bool put(const file &downloaded, std::string &local_name, std::vector<file> &evicted,
+                 std::vector<std::string> &evicted_leftovers) {
+            std::lock_guard<std::mutex> guard(_m);
+            _key key(downloaded.origin_node, downloaded.origin_name);
+            auto inserted = _files.insert({key, downloaded});
+            file &f = inserted.first->second;
+            if (inserted.second)
+                _local_names[f.local_name] = key;
+            else {
+                release(inserted.first);
+                // a new version starts over from the shortest time between checks
+                if (f.version != downloaded.version || !f.valid)
+                    f.ttr = downloaded.ttr;
+                f.version = downloaded.version;
+                f.hash = downloaded.hash;
+                f.check_time = downloaded.check_time;
+                f.size = downloaded.size;
+                f.valid = true;
+            }
+            _used.push_front(key);
+            _positions[key] = _used.begin();
+            _bytes += f.size;
+            misses++;
+            local_name = f.local_name;
+            while (_budget > 0 && _bytes + _leftover_bytes > _budget && !_leftovers.empty()) {
+                evicted_leftovers.push_back(_leftovers.back().first);
+                _leftover_bytes -= _leftovers.back().second;
+                _leftover_positions.erase(_leftovers.back().first);
+                _leftovers.pop_back();
+                evictions++;
+            }
+            while (_budget > 0 && _bytes > _budget && _used.back() != key) {
+                auto it = _files.find(_used.back());
+                release(it);
+                evicted.push_back(it->second);
+                _local_names.erase(it->second.local_name);
+                _files.erase(it);
+                evictions++;
+            }
+            return inserted.second;
+        }
+
+        // mark a cached copy invalid if stale holds for it
+        // returns false if there is no such copy, it is already invalid or still valid
+        bool invalidate(int origin, const std::string &origin_name, std::function<bool(const file &)> stale, file &invalidated) {
+            std::lock_guard<std::mutex> guard(_m);
+            auto it = _files.find(_key(origin, origin_name));
+            if (it == _files.end() || !it->second.valid || !stale(it->second))
+                return false;
+            it->second.valid = false;
+            release(it);
+            invalidated = it->second;
+            return true;
+        }
+
+        // copies of the files last checked at least their own ttr seconds ago, which count as checked from now on
+        std::vector<file> due() {
+            std::vector<file> files;
+            auto now = std::chrono::system_clock::now();
+            std::lock_guard<std::mutex> guard(_m);
+            for (auto&& x : _files) {
+                if (x.second.valid && now - x.second.check_time >= std::chrono::seconds(x.second.ttr)) {
+                    x.second.check_time = now;
+                    files.push_back(x.second);
+                }
+            }
+            return files;
+        }
+
+        // time until the next copy is due to be checked, or limit if none is due sooner
+        std::chrono::milliseconds next_due(std::chrono::milliseconds limit) {
+            auto now = std::chrono::system_clock::now();
+            std::lock_guard<std::mutex> guard(_m);
+            for (auto&& x : _files) {
+                if (x.second.valid) {
+                    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        x.second.check_time + std::chrono::seconds(x.second.ttr) - now);
+                    limit = std::max(std::min(limit, wait), std::chrono::milliseconds(0));
+                }
+            }
+            return limit;
+        }
+
+        // multiply the time between checks of a copy found unchanged, up to max_ttr seconds
+        // a copy which was replaced by another version since the check is left as it is
+        void extend(int origin, const std::string &origin_name, time_t version, int growth, int max_ttr) {
+            std::lock_guard<std::mutex> guard(_m);
+            auto it = _files.find(_key(origin, origin_name));
+            if (it != _files.end() && it->second.valid && it->second.version == version)
+                it->second.ttr = std::max(std::min(std::max(it->second.ttr * growth, it->second.ttr + 1), max_ttr), it->second.ttr);
+        }
+
+        // drop every file marked invalid, returning the origin node and name of the files left
+        std::set<std::pair<int, std::string>> drop_invalid() {
+            std::set<std::pair<int, std::string>> remaining;
+            std::lock_guard<std::mutex> guard(_m);
+            for (auto it = _files.begin(); it != _files.end();) {
+                if (it->second.valid) {
+                    remaining.insert(it->first);
+                    it++;
+                }
+                else {
+                    _local_names.erase(it->second.local_name);
+                    it = _files.erase(it);
+                }
+            }
+            return remaining;
+        }
+
+        std::vector<file> snapshot() {
+            std::lock_guard<std::mutex> guard(_m);
+            std::vector<file> files;
+            for (auto&& x : _files)
+                files.push_back(x.second);
+            return files;
+        }
+};
+
+#endif
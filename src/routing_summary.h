@@ -0,0 +1,164 @@
+#ifndef ROUTING_SUMMARY_H
+#define ROUTING_SUMMARY_H
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <string>
+#include <vector>
+
+
+#define SUMMARY_BITS 16384 // bits in each level of a routing summary
+#define SUMMARY_HASHES 4 // bits set per filename
+
+
+// set of filenames which can answer 'maybe' for filenames never added, but never 'no' for one which was
+class BloomFilter {
+    private:
+        std::vector<uint64_t> _words;
+        uint32_t _bits;
+        int _hashes;
+
+        // 64 bit FNV-1a, fixed so filters built by different builds of the peer agree
+        static uint64_t hash(const std::string &filename) {
+            uint64_t h = 14695981039346656037ULL;
+            for (unsigned char c : filename) {
+                h ^= c;
+                h *= 1099511628211ULL;
+            }
+            return h;
+        }
+
+        // position of the ith bit of a filename, derived from a single hash by double hashing
+        uint32_t bit(uint64_t h, int i) const {
+            uint32_t h1 = (uint32_t)h;
+            uint32_t h2 = (uint32_t)(h >> 32) | 1;
+            return (h1 + i * h2) % _bits;
+        }
+
+    public:
+        BloomFilter(uint32_t bits=SUMMARY_BITS, int hashes=SUMMARY_HASHES)
+            : _words((bits + 63) / 64, 0), _bits(bits), _hashes(hashes) {}
+
+        void add(const std::string &filename) {
+            uint64_t h = hash(filename);
+            for (int i = 0; i < _hashes; i++) {
+                uint32_t b = bit(h, i);
+                _words[b / 64] |= 1ULL << (b % 64);
+            }
+        }
+
+        bool might_contain(const std::string &filename) const {
+            uint64_t h = hash(filename);
+            for (int i = 0; i < _hashes; i++) {
+                uint32_t b = bit(h, i);
+                if (!(_words[b / 64] & (1ULL << (b % 64))))
+                    return false;
+            }
+            return true;
+        }
+
+        // answer 'maybe' for every filename
+        void fill() {
+            for (auto&& word : _words)
+                word = ~0ULL;
+        }
+
+        // add every filename of another filter of the same size
+        void merge(const BloomFilter &other) {
+            for (size_t i = 0; i < _words.size() && i < other._words.size(); i++)
+                _words[i] |= other._words[i];
+        }
+
+        uint32_t bits() const { return _bits; }
+        int hashes() const { return _hashes; }
+
+        void append_to(std::string &data) const {
+            for (auto&& word : _words) {
+                uint32_t halves[2] = {htonl((uint32_t)(word >> 32)), htonl((uint32_t)word)};
+                data.append((const char *)halves, sizeof(halves));
+            }
+        }
+
+        // read the words of a filter from data at offset, returning false if data is too short
+        bool read_from(const std::string &data, size_t &offset) {
+            for (auto&& word : _words) {
+                uint32_t halves[2];
+                if (offset + sizeof(halves) > data.size())
+                    return false;
+                memcpy(halves, data.data() + offset, sizeof(halves));
+                offset += sizeof(halves);
+                word = ((uint64_t)ntohl(halves[0]) << 32) | ntohl(halves[1]);
+            }
+            return true;
+        }
+};
+
+
+// attenuated bloom filter a super peer advertises to a neighbor
+// level i holds the filenames indexed i hops past the neighbor, so a query only has to be
+// forwarded to the neighbor if a level it can still reach with its remaining ttl might hold the file
+class RoutingSummary {
+    public:
+        std::vector<BloomFilter> levels;
+
+        // checks if a query arriving at the peer with ttl hops left could find filename
+        bool might_reach(const std::string &filename, int ttl) const {
+            for (int i = 0; i <= ttl && i < (int)levels.size(); i++) {
+                if (levels[i].might_contain(filename))
+                    return true;
+            }
+            return false;
+        }
+
+        // build the summary to advertise from the local index and the summaries received from every other neighbor
+        // a neighbor without a usable summary is given as nullptr, and then anything past this peer might match
+        static RoutingSummary build(const BloomFilter &local, const std::vector<const RoutingSummary *> &neighbors, int depth) {
+            RoutingSummary summary;
+            summary.levels.push_back(local);
+            for (int i = 1; i < depth; i++) {
+                BloomFilter level(local.bits(), local.hashes());
+                for (auto&& neighbor : neighbors) {
+                    if (neighbor == nullptr || neighbor->levels.size() < (size_t)i ||
+                        neighbor->levels[i - 1].bits() != local.bits() || neighbor->levels[i - 1].hashes() != local.hashes())
+                        level.fill();
+                    else
+                        level.merge(neighbor->levels[i - 1]);
+                }
+                summary.levels.push_back(level);
+            }
+            return summary;
+        }
+
+        // levels, bits and hashes followed by the words of every level
+        std::string encode() const {
+            std::string data;
+            uint32_t header[3] = {htonl((uint32_t)levels.size()), htonl(levels.empty() ? 0 : levels[0].bits()),
+                                  htonl(levels.empty() ? 0 : (uint32_t)levels[0].hashes())};
+            data.append((const char *)header, sizeof(header));
+            for (auto&& level : levels)
+                level.append_to(data);
+            return data;
+        }
+
+        bool decode(const std::string &data) {
+            uint32_t header[3];
+            if (data.size() < sizeof(header))
+                return false;
+            memcpy(header, data.data(), sizeof(header));
+            uint32_t depth = ntohl(header[0]), bits = ntohl(header[1]), hashes = ntohl(header[2]);
+            if (depth > 64 || bits == 0 || hashes == 0 || hashes > 64 ||
+                data.size() != sizeof(header) + (size_t)depth * ((bits + 63) / 64) * sizeof(uint64_t))
+                return false;
+            size_t offset = sizeof(header);
+            levels.assign(depth, BloomFilter(bits, hashes));
+            for (auto&& level : levels) {
+                if (!level.read_from(data, offset))
+                    return false;
+            }
+            return offset == data.size();
+        }
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef SERVED_FILES_H
+#define SERVED_FILES_H
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+// a file held open to be served, closed once the cache and every request using it are done with it
+class OpenFile {
+    public:
+        const int fd;
+
+        explicit OpenFile(int fd) : fd(fd) {}
+        OpenFile(const OpenFile &) = delete;
+        OpenFile &operator=(const OpenFile &) = delete;
+
+        ~OpenFile() {
+            close(fd);
+        }
+};
+
+
+// files a node server sent recently, kept open with everything a reply says about them,
+// so serving a hot file again needs no open, stat or version lookup
+// entries are dropped whenever the file may have changed, and least recently used first beyond the capacity
+class ServedFiles {
+    public:
+        struct file {
+            std::shared_ptr<OpenFile> open;
+            int64_t size;
+            int origin; // id of the origin node
+            time_t version;
+            uint64_t hash; // content hash, 0 if unknown
+            bool remote; // a cached copy from the remote files directory
+        };
+
+    private:
+        struct _entry {
+            file served;
+            std::list<std::string>::iterator used; // position in the least recently used order
+        };
+
+        std::mutex _m;
+        std::unordered_map<std::string, _entry> _entries;
+        std::list<std::string> _used; // names, most recently used first
+        size_t _capacity;
+        uint64_t _changes = 0; // count of removals, so a file opened before one of them is not kept
+
+    public:
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+
+        ServedFiles(size_t capacity=0) : _capacity(capacity) {}
+
+        void set_capacity(size_t capacity) {
+            std::lock_guard<std::mutex> guard(_m);
+            _capacity = capacity;
+            while (_entries.size() > _capacity) {
+                _entries.erase(_used.back());
+                _used.pop_back();
+            }
+        }
+
+        bool find(const std::string &name, file &found) {
+            std::lock_guard<std::mutex> guard(_m);
+            auto it = _entries.find(name);
+            if (it == _entries.end()) {
+                misses++;
+                return false;
+            }
+            _used.splice(_used.begin(), _used, it->second.used);
+            found = it->second.served;
+            hits++;
+            return true;
+        }
+
+        // taken before a file is opened and handed to put, which drops the file if anything was removed in between
+        uint64_t changes() {
+            std::lock_guard<std::mutex> guard(_m);
+            return _changes;
+        }
+
+        void put(const std::string &name, const file &served, uint64_t changes) {
+            std::lock_guard<std::mutex> guard(_m);
+            if (_capacity == 0 || changes != _changes)
+                return;
+            auto it = _entries.find(name);
+            if (it != _entries.end()) {
+                _used.erase(it->second.used);
+                _entries.erase(it);
+            }
+            if (_entries.size() >= _capacity) {
+                _entries.erase(_used.back());
+                _used.pop_back();
+            }
+            _used.push_front(name);
+            _entries[name] = {served, _used.begin()};
+        }
+
+        void remove(const std::string &name) {
+            std::lock_guard<std::mutex> guard(_m);
+            _changes++;
+            auto it = _entries.find(name);
+            if (it == _entries.end())
+                return;
+            _used.erase(it->second.used);
+            _entries.erase(it);
+        }
+
+        void clear() {
+            std::lock_guard<std::mutex> guard(_m);
+            _changes++;
+            _entries.clear();
+            _used.clear();
+        }
+};
+
+#endif
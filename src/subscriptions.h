@@ -0,0 +1,125 @@
+#ifndef SUBSCRIPTIONS_H
+#define SUBSCRIPTIONS_H
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+#define SUBSCRIPTIONS_SHARDS 64 // number of independently locked parts of the subscriptions table
+
+
+// leaf nodes caching a copy of a file, by the file's origin node and name
+// invalidations for a file only go to the leaves subscribed to it, so they scale with
+// the number of cached copies rather than the number of leaf nodes attached to the super peer
+class Subscriptions {
+    private:
+        struct _shard {
+            std::mutex m;
+            // filename, then origin node of the file and the leaves caching it
+            std::unordered_map<std::string, std::unordered_map<int, std::unordered_set<int>>> subscribers;
+            std::unordered_map<int, std::unordered_set<std::string>> node_files; // filenames of this shard each leaf subscribed to
+        };
+        _shard _shards[SUBSCRIPTIONS_SHARDS];
+
+        _shard &shard(const std::string &filename) {
+            return _shards[std::hash<std::string>()(filename) % SUBSCRIPTIONS_SHARDS];
+        }
+
+        // remove a leaf from a single origin's copy of a locked shard's filename, dropping anything left empty
+        // returns true if the leaf no longer caches the filename from any origin
+        static bool remove_from_file(_shard &s, const std::string &filename, int origin, int node) {
+            auto it = s.subscribers.find(filename);
+            if (it == s.subscribers.end())
+                return true;
+            auto origin_it = it->second.find(origin);
+            if (origin_it != it->second.end()) {
+                origin_it->second.erase(node);
+                if (origin_it->second.empty())
+                    it->second.erase(origin_it);
+            }
+            bool last = true;
+            for (auto const &x : it->second) {
+                if (x.second.count(node))
+                    last = false;
+            }
+            if (it->second.empty())
+                s.subscribers.erase(it);
+            return last;
+        }
+
+    public:
+        // returns false if the leaf was already subscribed to the file
+        bool subscribe(int origin, const std::string &filename, int node) {
+            _shard &s = shard(filename);
+            std::lock_guard<std::mutex> guard(s.m);
+            if (!s.subscribers[filename][origin].insert(node).second)
+                return false;
+            s.node_files[node].insert(filename);
+            return true;
+        }
+
+        void unsubscribe(int origin, const std::string &filename, int node) {
+            _shard &s = shard(filename);
+            std::lock_guard<std::mutex> guard(s.m);
+            if (!remove_from_file(s, filename, origin, node))
+                return;
+            auto node_it = s.node_files.find(node);
+            if (node_it != s.node_files.end()) {
+                node_it->second.erase(filename);
+                if (node_it->second.empty())
+                    s.node_files.erase(node_it);
+            }
+        }
+
+        // remove every subscription of a leaf, used when it disconnects
+        void remove_id(int node) {
+            for (auto&& s : _shards) {
+                std::lock_guard<std::mutex> guard(s.m);
+                auto node_it = s.node_files.find(node);
+                if (node_it == s.node_files.end())
+                    continue;
+                for (auto const &filename : node_it->second) {
+                    auto it = s.subscribers.find(filename);
+                    if (it == s.subscribers.end())
+                        continue;
+                    for (auto origin_it = it->second.begin(); origin_it != it->second.end();) {
+                        origin_it->second.erase(node);
+                        origin_it = origin_it->second.empty() ? it->second.erase(origin_it) : std::next(origin_it);
+                    }
+                    if (it->second.empty())
+                        s.subscribers.erase(it);
+                }
+                s.node_files.erase(node_it);
+            }
+        }
+
+        // copy of the leaves caching a file from an origin node
+        std::vector<int> find(int origin, const std::string &filename) {
+            _shard &s = shard(filename);
+            std::lock_guard<std::mutex> guard(s.m);
+            auto it = s.subscribers.find(filename);
+            if (it == s.subscribers.end())
+                return std::vector<int>();
+            auto origin_it = it->second.find(origin);
+            if (origin_it == it->second.end())
+                return std::vector<int>();
+            return std::vector<int>(origin_it->second.begin(), origin_it->second.end());
+        }
+
+        // visit every cached file with its origin node and subscribed leaves, holding one shard's lock at a time
+        void for_each(std::function<void(const std::string &, int, const std::unordered_set<int> &)> f) {
+            for (auto&& s : _shards) {
+                std::lock_guard<std::mutex> guard(s.m);
+                for (auto const &file : s.subscribers) {
+                    for (auto const &origin : file.second)
+                        f(file.first, origin.first, origin.second);
+                }
+            }
+        }
+};
+
+#endif
@@ -1,10 +1,21 @@
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <queue>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <map>
 #include <unordered_map>
 #include <iostream>
 #include <sstream>
@@ -13,13 +24,63 @@
 #include <chrono>
 #include <fstream>
 
+#include "protocol.h"
+#include "files_index.h"
+#include "routing_summary.h"
+#include "message_ids.h"
+#include "subscriptions.h"
+#include "invalidation_batcher.h"
+#include "logger.h"
 
 #define HOST "localhost" // assume all connections happen on same machine
-#define MAX_FILENAME_SIZE 256 // assume the maximum file size is 256 characters
-#define MAX_MSG_SIZE 4096
+#define MAX_EVENTS 64 // maximum events handled by a reactor per epoll_wait call
+#define SUMMARY_REFRESH_INTERVALS 10 // unchanged routing summaries are sent again after this many intervals
+#define SUMMARY_EXPIRY_INTERVALS 30 // a neighbor's routing summary is ignored once it is this many intervals old
+#define FORWARDING_THREADS 16 // default number of threads running work which waits on other servers
 
 
 enum CONSISTENCY_METHODS{PUSH, PULL_N, PULL_P}; // cleaner comparisons for consistency method in use
+enum IO_MODELS{THREADS, REACTOR}; // thread-per-connection or epoll reactors driving a worker pool
+
+
+// fixed set of threads for running connection handlers queued by the reactors
+class WorkerPool {
+    private:
+        std::vector<std::thread> _workers;
+        std::queue<std::function<void()>> _tasks;
+
+        std::mutex _tasks_m;
+        std::condition_variable _tasks_cv;
+
+        void work() {
+            while (1) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(_tasks_m);
+                    _tasks_cv.wait(lock, [this]{ return !_tasks.empty(); });
+                    task = std::move(_tasks.front());
+                    _tasks.pop();
+                }
+                task();
+            }
+        }
+
+    public:
+        void start(int size) {
+            for (int i = 0; i < size; i++) {
+                _workers.emplace_back(&WorkerPool::work, this);
+                _workers.back().detach();
+            }
+        }
+
+        void submit(std::function<void()> task) {
+            {
+                std::lock_guard<std::mutex> guard(_tasks_m);
+                _tasks.push(std::move(task));
+            }
+            _tasks_cv.notify_one();
+        }
+};
 
 
 class SuperPeer {
@@ -27,44 +88,85 @@ class SuperPeer {
         std::vector<int> _peers;
         std::vector<int> _nodes;
 
-        std::unordered_map<std::string, std::vector<int>> _files_index; // mapping between a filename and any peers associated with it
+        FilesIndex _files_index; // mapping between a filename and any peers associated with it
+        Subscriptions _subscriptions; // leaf nodes caching a copy of each file, invalidations only go to them
+        InvalidationBatcher _node_invalidations; // invalidations waiting to be sent to each leaf node
+        InvalidationBatcher _peer_invalidations; // invalidations waiting to be sent to each neighbor peer
 
-        struct _file {
-            std::string name; // name of file modified
-            int id; // origin node fo modified file
-            time_t version; // version of the modified file
-        };
-        std::vector<_file> _modified_files; // vector of files modified from leaf nodes to check every ttr
+        // origin node and name of every file modified by leaf nodes since the last ttr, with its latest version and content hash
+        std::map<std::pair<int, std::string>, std::pair<time_t, uint64_t>> _modified_files;
         
-        struct _message_id_hash {
-            size_t operator()(const std::pair<int, int>& p) const { return p.first ^ p.second; }
+        MessageIds _message_ids; // ids of flooded messages seen in the last minute
+
+        std::unordered_map<std::string, std::string> _options; // optional 'key value' settings from the config file
+
+        struct _pending_reply {
+            int socket_fd; // link socket the request was written to
+            std::promise<std::string> reply;
         };
-        
-        typedef std::pair<int, int> _message_id_t;
-        std::unordered_map<_message_id_t, std::chrono::system_clock::time_point, _message_id_hash> _message_ids;
-        
-        std::ofstream _server_logs;
 
-        std::mutex _files_index_m;
-        std::mutex _modified_files_m;
-        std::mutex _message_ids_m;
-        std::mutex _log_m;
+        // reply a query is waiting on from a single neighbor peer
+        struct _peer_reply {
+            int peer;
+            uint32_t request_id;
+            std::future<std::string> ids;
+        };
 
-        // helper function for getting the current time to microsecond-accuracy as a string
-        std::string time_now() {
-            std::chrono::high_resolution_clock::duration now = std::chrono::high_resolution_clock::now().time_since_epoch();
-            std::chrono::microseconds now_ms = std::chrono::duration_cast<std::chrono::microseconds>(now);
-            return std::to_string(now_ms.count());
-        }
+        // long-lived connection to a neighbor peer shared by every message sent to it
+        struct _peer_link {
+            int peer;
+            int socket_fd = -1; // -1 while disconnected, the next message reconnects
+            std::chrono::steady_clock::time_point retry_time; // earliest time to reconnect after a failed connection
+            std::mutex send_m; // held while connecting or writing a whole message
+            std::mutex pending_m;
+            std::unordered_map<uint32_t, _pending_reply> pending; // queries still waiting on a reply
+        };
+        std::unordered_map<int, std::unique_ptr<_peer_link>> _peer_links; // pooled link for each neighbor peer
+        std::atomic<uint32_t> _request_id{0};
+        struct sockaddr_in _host_addr; // address of HOST used for every outgoing connection
+
+        // pooled link opened by a neighbor peer, replies to concurrent requests share the socket
+        struct _peer_session {
+            int socket_fd;
+            std::mutex send_m;
+
+            _peer_session(int socket_fd) : socket_fd(socket_fd) {}
+            ~_peer_session() { close(socket_fd); }
+        };
+
+        // state of a socket owned by a reactor
+        struct _connection {
+            int socket_fd;
+            int epoll_fd; // reactor which owns the socket
+            int id; // id of the leaf node once identified, -1 until the connection type is known
+            std::shared_ptr<_peer_session> session; // set once identified as a pooled link from a neighbor peer
+        };
+        std::vector<int> _epoll_fds; // one epoll instance per reactor thread
+        std::atomic<unsigned int> _next_reactor{0}; // round robin counter for assigning accepted sockets to reactors
+        WorkerPool _workers;
+        WorkerPool _forwarding; // work which waits on other servers, kept off the threads serving connections
+
+        struct _peer_summary {
+            RoutingSummary summary;
+            std::chrono::steady_clock::time_point received;
+        };
+        std::unordered_map<int, _peer_summary> _peer_summaries; // latest routing summary from each neighbor peer
+        std::mutex _peer_summaries_m;
+
+        Protocol _protocol; // encodes every message sent or received in the configured wire format
+
+        Logger _logger;
+        int _server_log = -1; // sink of the peer's log file
+
+        std::mutex _modified_files_m;
 
-        // log message to specified log file
-        void log(std::string type, std::string msg) {
-            std::lock_guard<std::mutex> guard(_log_m);
-            _server_logs << '[' << time_now() << "] [" << type << "] " << msg  << '\n' << std::endl;
-            std::cout << '[' << time_now() << "] [" << type << "] [" << msg  << "]\n" << std::endl;
+        // log message to the peer's log file, and stdout if echoing the level
+        void log(const std::string &type, const std::string &msg, int level=LOG_INFO) {
+            _logger.write(_server_log, level, type, msg);
         }
         
         void error(std::string type) {
+            _logger.stop();
             std::cerr << "\n[" << type << "] exiting program\n" << std::endl;
             exit(1);
         }
@@ -74,717 +176,667 @@ class SuperPeer {
             std::string msg = "closing connection for id '" + std::to_string(id) + "' and cleaning up index";
             log(type, msg);
             files_index_cleanup(id);
+            _subscriptions.remove_id(id);
             close(socket_fd);
         }
 
         // create a connection to some server given a specific port
-        int connect_server(int port) {
-            struct sockaddr_in addr;
+        int connect_server(int port, int timeout=IO_TIMEOUT) {
+            struct sockaddr_in addr = _host_addr; // host is resolved once when the peer starts
             socklen_t addr_size = sizeof(addr);
-            bzero((char *)&addr, addr_size);
 
             // open a socket for the new connection
-            struct hostent *server = gethostbyname(HOST);
             int socket_fd = socket(AF_INET, SOCK_STREAM, 0);
-
-            addr.sin_family = AF_INET;
-            bcopy((char *)server->h_addr, (char *)&addr.sin_addr.s_addr, server->h_length);
             addr.sin_port = htons(port);
             
-            // connect to the server
+            // connect to the server without blocking, so an unreachable server costs at most the timeout
+            int flags = fcntl(socket_fd, F_GETFL, 0);
+            fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK);
             if (connect(socket_fd, (struct sockaddr *)&addr, addr_size) < 0) {
-                return -1;
+                int connect_error = 0;
+                socklen_t error_size = sizeof(connect_error);
+                if (errno != EINPROGRESS || !wait_socket(socket_fd, POLLOUT, timeout) ||
+                    getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, &connect_error, &error_size) < 0 || connect_error != 0) {
+                    close(socket_fd);
+                    return -1;
+                }
             }
+            fcntl(socket_fd, F_SETFL, flags);
             
             return socket_fd;
         }
 
+        // waits until a non-blocking socket is ready for the given events
+        bool wait_socket(int socket_fd, short events, int timeout=IO_TIMEOUT) {
+            struct pollfd pfd = {socket_fd, events, 0};
+            return poll(&pfd, 1, timeout) > 0;
+        }
+
         // handle all requests sent to the peer
         void handle_connection(int socket_fd) {
-            char request;
+            message msg;
             //initialize connection by getting request type
-            if (recv(socket_fd, &request, sizeof(request), 0) < 0) {
-                log("conn unidentified", "closing connection");
+            if (_protocol.recv_message(socket_fd, SUPER_PEER_CONNECTION, msg) != MSG_OK) {
+                log("conn unidentified", "closing connection", LOG_WARNING);
                 close(socket_fd);
                 return;
             }
 
-            switch (request) {
-                case '0':
-                    handle_peer_request(socket_fd);
+            switch (msg.type) {
+                case PEER_QUERY:
+                case PEER_INVALIDATE:
+                case PEER_COMPARE:
+                    handle_peer_request(socket_fd, msg);
                     break;
-                case '1':
-                    handle_node_request(socket_fd);
+                case NODE_CONNECT:
+                    while (handle_node_message(socket_fd, msg.id));
+                    break;
+                case PEER_LINK_CONNECT:
+                    handle_peer_link(socket_fd);
                     break;
-                default:
-                    log("conn unidentified", "closing connection");
-                    close(socket_fd);
-                    return;
             }
         }
 
-        // handle requests from neighbor peers
-        void handle_peer_request(int socket_fd) {
-            char request;
-            // get request type from node
-            if (recv(socket_fd, &request, sizeof(request), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
-                return;
-            }
-
-            switch (request) {
-                case '1':
-                    query(socket_fd);
-                    break;
-                case '2':
-                    invalidate(socket_fd);
-                    break;
-                case '3':
-                    compare(socket_fd);
-                    break;
-                default:
-                    log("peer unresponsive", "ignoring request");
-                    close(socket_fd);
-                    return;
+        // handle a single request from a neighbor peer which opened a connection just for it
+        void handle_peer_request(int socket_fd, message &msg) {
+            std::string ids = process_peer_message(msg);
+            if (msg.type == PEER_QUERY) {
+                message reply;
+                reply.type = PEER_REPLY;
+                reply.text = ids;
+                // send comma delimited list of all ids for a specific file to the peer
+                if (!_protocol.send_message(socket_fd, reply))
+                    log("peer unresponsive", "ignoring request", LOG_WARNING);
             }
+            close(socket_fd);
+            log("peer disconnected", "closed connection", LOG_DEBUG);
         }
 
-        // query local files index and broadcast message to neighbor peers
-        void query(int socket_fd) {
-            // get the ttl value of the sent message
-            int ttl;
-            if (recv(socket_fd, &ttl, sizeof(ttl), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
-                return;
-            }
+        // handle every request sent by a neighbor peer over its pooled link
+        void handle_peer_link(int socket_fd) {
+            std::shared_ptr<_peer_session> session(new _peer_session(socket_fd));
+            log("peer connected", "opened pooled connection", LOG_DEBUG);
 
-            // get the id part of the message id
-            int id;
-            if (recv(socket_fd, &id, sizeof(id), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
-                return;
+            message msg;
+            while (_protocol.recv_message(socket_fd, PEER_LINK, msg) == MSG_OK) {
+                // requests are handed to the forwarding threads so a slow query does not hold up the rest of the link
+                _forwarding.submit([this, session, msg]{ reply_peer_link(session, msg); });
             }
+            log("peer disconnected", "closed pooled connection", LOG_DEBUG);
+        }
 
-            // get the sequence message part of the message id
-            int sequence_number;
-            if (recv(socket_fd, &sequence_number, sizeof(sequence_number), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
-                return;
-            }            
-
-            char buffer[MAX_FILENAME_SIZE];
-            // recieve filename
-            if (recv(socket_fd, buffer, sizeof(buffer), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
+        // run a request from a pooled link and send back the reply tagged with its request id
+        void reply_peer_link(std::shared_ptr<_peer_session> session, message msg) {
+            if (msg.type == LINK_SUMMARY) {
+                store_peer_summary(msg);
                 return;
             }
-
-            std::string ids;
-            // check if message id has been seen/forwarded already
-            if (check_message_id(socket_fd)) {
-                // get all ids from local files index
-                ids = query_local_files_index(buffer);
-                if (ttl-- > 0) {
-                    // get all nodes ids from all neighbor peers' files indexes
-                    std::string peers_ids = query_peers_files_index(buffer, id, sequence_number, ttl);
-                    // only add anything if ids where found in peers
-                    if (!peers_ids.empty())
-                        ids += ((!ids.empty()) ? "," : "") + peers_ids;
+            if (msg.type == LINK_INVALIDATE_BATCH) {
+                std::vector<message> invalidations;
+                if (!_protocol.decode_batch(msg.text, invalidations)) {
+                    log("malformed batch", "ignoring request", LOG_WARNING);
+                    return;
+                }
+                for (auto&& invalidation : invalidations) {
+                    if (invalidation.type == LINK_INVALIDATE)
+                        process_peer_message(invalidation);
                 }
-            }
-
-            char buffer_[MAX_MSG_SIZE];
-            strcpy(buffer_, ids.c_str());
-            // send comma delimited list of all ids for a specific file to the peer
-            if (send(socket_fd, buffer_, sizeof(buffer_), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
                 return;
             }
-            close(socket_fd);
-            log("peer disconnected", "closed connection");
-        }
 
-        // invalidate cached file and broadcast message to neighbor peers
-        void invalidate(int socket_fd) {
-            // get the ttl value of the sent message
-            int ttl;
-            if (recv(socket_fd, &ttl, sizeof(ttl), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
+            std::string ids = process_peer_message(msg);
+            if (msg.type != LINK_QUERY)
                 return;
-            }
 
-            // get the id part of the message id
-            int id;
-            if (recv(socket_fd, &id, sizeof(id), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
-                return;
-            }
+            message reply;
+            reply.type = LINK_REPLY;
+            reply.request_id = msg.request_id;
+            reply.text = ids;
 
-            // get the sequence message part of the message id
-            int sequence_number;
-            if (recv(socket_fd, &sequence_number, sizeof(sequence_number), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
-                return;
-            }            
+            std::lock_guard<std::mutex> guard(session->send_m);
+            if (!_protocol.send_message(session->socket_fd, reply))
+                log("peer unresponsive", "ignoring request", LOG_WARNING);
+        }
 
-            char buffer[MAX_FILENAME_SIZE];
-            // recieve filename
-            if (recv(socket_fd, buffer, sizeof(buffer), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
-                return;
+        // run a request from a neighbor peer, returning the ids found for queries
+        std::string process_peer_message(message &msg) {
+            std::string ids;
+            // check if message id has been seen/forwarded already
+            if (!check_message_id(msg.message_id, msg.message_sequence_number))
+                return ids;
+
+            switch (msg.type) {
+                case PEER_QUERY:
+                case LINK_QUERY:
+                    // get all ids from local files index
+                    ids = query_local_files_index(msg.filename);
+                    if (msg.ttl-- > 0) {
+                        // get all nodes ids from all neighbor peers' files indexes
+                        std::string peers_ids = query_peers_files_index(msg.filename, msg.id, msg.sequence_number, msg.ttl);
+                        // only add anything if ids where found in peers
+                        if (!peers_ids.empty())
+                            ids += ((!ids.empty()) ? "," : "") + peers_ids;
+                    }
+                    break;
+                case PEER_INVALIDATE:
+                case LINK_INVALIDATE:
+                    // invalidate cached file and broadcast message to neighbor peers
+                    invalidate_nodes(msg.id, msg.filename, msg.version, msg.hash);
+                    if (msg.ttl-- > 0)
+                        invalidate_peers(msg.id, msg.filename, msg.version, msg.hash, msg.sequence_number, msg.ttl);
+                    break;
+                case PEER_COMPARE:
+                case LINK_COMPARE:
+                    // only leaf nodes caching the file are sent the modified version
+                    invalidate_nodes(msg.id, msg.filename, msg.version, msg.hash);
+                    if (msg.ttl-- > 0)
+                        compare_peers(msg.filename, msg.id, msg.sequence_number, msg.ttl, msg.version, msg.hash);
+                    break;
             }
+            return ids;
+        }
 
-            // get the version number of the file
-            time_t version;
-            if (recv(socket_fd, &version, sizeof(version), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
+        // send a message to a single leaf node on a connection of its own
+        void send_node_message(int node, const message &msg) {
+            int socket_fd = connect_server(node);
+            if (socket_fd < 0) {
+                log("failed node connection", "ignoring connection", LOG_WARNING);
                 return;
             }
-
-            // check if message id has been seen/forwarded already
-            if (check_message_id(socket_fd)) {
-                invalidate_nodes(id, buffer, version);
-                if (ttl-- > 0)
-                    invalidate_peers(id, buffer, version, sequence_number, ttl);
-            }
+            if (!_protocol.send_message(socket_fd, msg))
+                log("node unresponsive", "ignoring request", LOG_WARNING);
             close(socket_fd);
-            log("peer disconnected", "closed connection");
         }
 
-        void compare(int socket_fd) {
-            // get the ttl value of the sent message
-            int ttl;
-            if (recv(socket_fd, &ttl, sizeof(ttl), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
-                return;
+        // handle a single request from an identified node
+        // returns false once the connection has been closed
+        bool handle_node_message(int socket_fd, int id) {
+            message msg;
+            switch (_protocol.recv_message(socket_fd, NODE_LINK, msg)) {
+                case MSG_NONE:
+                    // spurious wakeup of a reactor owned socket, wait for the next event
+                    return true;
+                case MSG_CLOSED:
+                    remove_node(socket_fd, id, "node disconnected");
+                    return false;
+                case MSG_ERROR:
+                    remove_node(socket_fd, id, "node unresponsive");
+                    return false;
             }
+            return process_node_message(socket_fd, id, msg);
+        }
 
-            // get the id part of the message id
-            int id;
-            if (recv(socket_fd, &id, sizeof(id), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
-                return;
+        // run a single request received from an identified node
+        // returns false once the connection has been closed
+        bool process_node_message(int socket_fd, int id, message &msg) {
+            switch (msg.type) {
+                case REGISTRY:
+                case DEREGISTRY:
+                case REMOTE_REGISTRY:
+                case REMOTE_DEREGISTRY:
+                    apply_registration(id, msg);
+                    return true;
+                case REGISTRY_BATCH:
+                    return registry_batch(socket_fd, id, msg);
+                case SEARCH:
+                    return node_search(socket_fd, id, msg.filename);
+                case PRINT_FILES_INDEX:
+                    print_files_map();
+                    return true;
+                case PRINT_MESSAGE_IDS:
+                    print_message_ids_list();
+                    return true;
+                case PRINT_MODIFIED_FILES:
+                    print_modified_files_list();
+                    return true;
+                case NODE_DISCONNECT:
+                default:
+                    remove_node(socket_fd, id, "node disconnected");
+                    return false;
             }
+        }
 
-            // get the sequence message part of the message id
-            int sequence_number;
-            if (recv(socket_fd, &sequence_number, sizeof(sequence_number), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
-                return;
-            }            
-
-
-            char buffer[MAX_FILENAME_SIZE];
-            // recieve filename
-            if (recv(socket_fd, buffer, sizeof(buffer), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
-                return;
+        // apply a single registration change from a node
+        void apply_registration(int id, message &msg) {
+            switch (msg.type) {
+                case REGISTRY:
+                    registry(id, msg.filename);
+                    break;
+                case DEREGISTRY:
+                    deregistry(id, msg.filename, msg.version, msg.hash);
+                    break;
+                case REMOTE_REGISTRY:
+                    remote_registry(id, msg.id, msg.filename);
+                    break;
+                case REMOTE_DEREGISTRY:
+                    remote_deregistry(id, msg.id, msg.filename);
+                    break;
             }
+        }
 
-            // get the version number of the file
-            time_t version;
-            if (recv(socket_fd, &version, sizeof(version), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
-                close(socket_fd);
-                return;
+        // apply every change of a node's registration batch in order, then acknowledge it
+        bool registry_batch(int socket_fd, int id, message &msg) {
+            std::vector<message> changes;
+            if (!_protocol.decode_batch(msg.text, changes)) {
+                remove_node(socket_fd, id, "malformed batch");
+                return false;
             }
+            for (auto&& change : changes)
+                apply_registration(id, change);
 
-            // check if message id has been seen/forwarded already
-            if (check_message_id(socket_fd)) {
-                // only compare file with current nodes if the file exists in the filex index
-                if (_files_index.find(buffer) != _files_index.end())
-                    compare_nodes(id, buffer, version);
-                if (ttl-- > 0) {
-                    compare_peers(buffer, id, sequence_number, ttl, version);
-                }
+            message ack;
+            ack.type = REGISTRY_ACK;
+            ack.request_id = msg.request_id;
+            if (!_protocol.send_message(socket_fd, ack)) {
+                remove_node(socket_fd, id, "node unresponsive");
+                return false;
             }
-            close(socket_fd);
-            log("peer disconnected", "closed connection");
+            return true;
         }
 
-        // compare a modified file from the origin server with cached versions in leaf nodes
-        void compare_nodes(int id, std::string filename, time_t version) {
-            for (auto&& node : _nodes) {
-                // ignore message for origin server
-                if (node == id)
-                    continue;
-                // only send invalidate message if node has registered the file then super peer
-                if((std::find(_files_index[filename].begin(), _files_index[filename].end(), node) != _files_index[filename].end())) {
-                    int socket_fd = connect_server(node);
-                    if (socket_fd < 0) {
-                        log("failed node connection", "ignoring connection");
-                        continue;
-                    }
-                    if (send(socket_fd, "0", sizeof(char), 0) < 0)
-                        log("node unresponsive", "ignoring request");
-                    else {
-                        // send the origin node of the file
-                        if (send(socket_fd, &id, sizeof(id), 0) < 0)
-                            log("node unresponsive", "ignoring request");
-                        else {
-                            // send the filname to check to invalidate
-                            char buffer[MAX_FILENAME_SIZE];
-                            strcpy(buffer, filename.c_str());
-                            if (send(socket_fd, buffer, sizeof(buffer), 0) < 0)
-                                log("node unresponsive", "ignoring request");
-                            else {
-                                // send the version number of the file
-                                if (send(socket_fd, &version, sizeof(version), 0) < 0)
-                                    log("node unresponsive", "ignoring request");
-                            }
-                        }
-                    }
-                    close(socket_fd);
-                }
-            } 
+        // registers a single file for a node
+        void registry(int id, std::string filename) {
+            // add peer's id to file map if not already included
+            _files_index.add(filename, id);
         }
 
-        // handle all requests sent to the indexing server
-        void handle_node_request(int socket_fd) {
-            int id;
-            //initialize connection with node by getting id
-            if (recv(socket_fd, &id, sizeof(id), 0) < 0) {
-                log("node unidentified", "closing connection");
-                close(socket_fd);
-                return;
-            }
-
-            char request;
-            while (1) {
-                request = '0';
-                // get request type from node
-                if (recv(socket_fd, &request, sizeof(request), 0) < 0) {
-                    remove_node(socket_fd, id, "node unresponsive");
-                    return;
-                }
-
-                switch (request) {
-                    case '1':
-                        registry(socket_fd, id);
-                        break;
-                    case '2':
-                        deregistry(socket_fd, id);
-                        break;
-                    case '3':
-                        node_search(socket_fd, id);
-                        break;
-                    case '4':
-                        print_files_map();
-                        break;
-                    case '5':
-                        print_message_ids_list();
-                        break;
-                    case '6':
-                        print_modified_files_list();
-                        break;
-                    case '0':
-                        remove_node(socket_fd, id, "node disconnected");
-                        return;
-                    default:
-                        remove_node(socket_fd, id, "unexpected request");
-                        return;
-                }
-            }
+        // registers a node's cached copy of a file, subscribing it to invalidations from the origin node
+        void remote_registry(int id, int origin, std::string filename) {
+            _files_index.add(filename, id);
+            _subscriptions.subscribe(origin, filename, id);
         }
 
-        // handles communication with node for registering a single file 
-        void registry(int socket_fd, int id) {
-            char buffer[MAX_FILENAME_SIZE];
-            // recieve filename from node
-            if (recv(socket_fd, buffer, sizeof(buffer), 0) < 0) {
-                remove_node(socket_fd, id, "node unresponsive");
-                return;
-            }
-            
-            std::string filename = std::string(buffer);
-            std::lock_guard<std::mutex> guard(_files_index_m);
-            // add peer's id to file map if not already included
-            if(!(std::find(_files_index[filename].begin(), _files_index[filename].end(), id) != _files_index[filename].end()))
-                _files_index[filename].push_back(id);
+        // deregisters a node's cached copy of a file once it has been dropped
+        void remote_deregistry(int id, int origin, std::string filename) {
+            remove_file_from_index(id, filename);
+            _subscriptions.unsubscribe(origin, filename, id);
         }
 
         void remove_file_from_index(int id, std::string filename) {
-            std::lock_guard<std::mutex> guard(_files_index_m);
-            // remove peer's id from file
-            _files_index[filename].erase(std::remove(_files_index[filename].begin(),
-                                            _files_index[filename].end(), id), _files_index[filename].end());
-            // remove filename from mapping if no more peers mapped to file
-            if (_files_index[filename].size() == 0)
-                _files_index.erase(filename);
-        }
-
-        // handles communication with node for deregistering a single file 
-        void deregistry(int socket_fd, int id) {
-            char buffer[MAX_FILENAME_SIZE];
-            if (recv(socket_fd, buffer, sizeof(buffer), 0) < 0) {
-                remove_node(socket_fd, id, "node unresponsive");
-                return;
-            }
+            // remove peer's id from file, and the filename from mapping if no more peers mapped to file
+            _files_index.remove(filename, id);
+        }
 
-            time_t version;
-            if (recv(socket_fd, &version, sizeof(version), 0) < 0) {
-                remove_node(socket_fd, id, "node unresponsive");
-                return;
-            }
- 
-            remove_file_from_index(id, buffer);
+        // deregisters a single file for a node, invalidating cached copies if the file was modified
+        void deregistry(int id, std::string filename, time_t version, uint64_t hash) {
+            remove_file_from_index(id, filename);
             if (version != -1) {
                 // checks if either consistency method is used to invalidate cached files
                 if (_consistency_method == PUSH) {
-                    invalidate_nodes(id, buffer, version);
-                    invalidate_peers(id, buffer, version, ++_sequence_number, _ttl);
+                    invalidate_nodes(id, filename, version, hash);
+                    invalidate_peers(id, filename, version, hash, ++_sequence_number, _ttl);
                 }
                 else if (_consistency_method == PULL_P) {
                     // adds modified files to a temporary list to be dealt with when the TTR expires
+                    // a file modified again before then only keeps its latest version
                     std::lock_guard<std::mutex> guard(_modified_files_m);
-                    _modified_files.push_back({buffer, id, version});
+                    std::pair<time_t, uint64_t> &latest = _modified_files[{id, filename}];
+                    if (version >= latest.first)
+                        latest = {version, hash};
                 }
             }
         }
 
-        // sends an invalidation message to all nodes connected nodes
-        void invalidate_nodes(int id, std::string filename, time_t version) {
-            for (auto&& node : _nodes) {
+        // sends an invalidation message to every connected node caching the file
+        void invalidate_nodes(int id, std::string filename, time_t version, uint64_t hash) {
+            message msg;
+            msg.type = NODE_INVALIDATE;
+            msg.id = id; // origin node of the file
+            msg.filename = filename;
+            msg.version = version;
+            msg.hash = hash; // lets a node whose copy already has the new contents keep it
+            // legacy nodes cannot subscribe, but register their cached copies as plain files, so every node
+            // registering the file is sent the invalidation
+            for (auto&& node : (_protocol.wire_format == LEGACY) ? _files_index.find(filename) : _subscriptions.find(id, filename)) {
                 // ignore origin node
                 if (node == id)
                     continue;
-                int socket_fd = connect_server(node);
-                if (socket_fd < 0) {
-                    log("failed node connection", "ignoring connection");
-                    continue;
-                }
-                if (send(socket_fd, "0", sizeof(char), 0) < 0)
-                    log("node unresponsive", "ignoring request");
-                else {
-                    // send origin node to node
-                    if (send(socket_fd, &id, sizeof(id), 0) < 0)
-                        log("node unresponsive", "ignoring request");
-                    else {
-                        // send filename
-                        char buffer[MAX_FILENAME_SIZE];
-                        strcpy(buffer, filename.c_str());
-                        if (send(socket_fd, buffer, sizeof(buffer), 0) < 0)
-                            log("node unresponsive", "ignoring request");
-                        else {
-                            // send version to node
-                            if (send(socket_fd, &version, sizeof(version), 0) < 0)
-                                log("node unresponsive", "ignoring request");
-                        }
-                    }
-                }
-                close(socket_fd);
+                if (_invalidation_window > 0)
+                    _node_invalidations.add(node, msg);
+                else
+                    send_node_message(node, msg);
             }
         }
 
         // broadcast invalidation message to all neighbor peers
-        void invalidate_peers(int id, std::string filename, time_t version, int sequence_number, int ttl) {
-            // iteratively query each peer to search their files index
-            for (auto&& peer : _peers) {
-                int socket_fd = connect_server(peer);
-                if (socket_fd < 0) {
-                    log("failed peer connection", "ignoring connection");
-                    continue;
-                }
-                if (send(socket_fd, "0", sizeof(char), 0) < 0)
-                    log("peer unresponsive", "ignoring request");
-                else {
-                    if (send(socket_fd, "2", sizeof(char), 0) < 0)
-                        log("peer unresponsive", "ignoring request");
-                    else {
-                        // send ttl value of current message
-                        if (send(socket_fd, &ttl, sizeof(ttl), 0) < 0)
-                            log("peer unresponsive", "ignoring request");
-                        else {
-                            // send the id part of the message id
-                            if (send(socket_fd, &id, sizeof(id), 0) < 0)
-                                log("peer unresponsive", "ignoring request");
-                            else {
-                                // send the sequence number part of the message id
-                                if (send(socket_fd, &sequence_number, sizeof(sequence_number), 0) < 0)
-                                    log("peer unresponsive", "ignoring request");
-                                else {
-                                    char buffer[MAX_FILENAME_SIZE];
-                                    strcpy(buffer, filename.c_str());
-                                    // send the filename of the request
-                                    if (send(socket_fd, buffer, sizeof(buffer), 0) < 0)
-                                        log("peer unresponsive", "ignoring request");
-                                    else {
-                                        // send the version of the file of the request
-                                        time_t version;
-                                        if (send(socket_fd, &version, sizeof(version), 0) < 0)
-                                            log("peer unresponsive", "ignoring request");
-                                        else {
-                                            if (!send_message_id(socket_fd, id, sequence_number))
-                                                log("peer unresponsive", "ignoring request");
-                                            else {
-                                                std::string msg = "msg id [" + std::to_string(id) + "," +
-                                                                  std::to_string(sequence_number) +
-                                                                  "] to peer " + std::to_string(peer);
-                                                log("forwarding message", msg);
-                                            }
-                                        }
-                                    }
-                                }
-                            }
+        void invalidate_peers(int id, std::string filename, time_t version, uint64_t hash, int sequence_number, int ttl) {
+            message msg = peer_message(LINK_INVALIDATE, ttl, id, sequence_number, filename, version, hash);
+            if (_invalidation_window == 0) {
+                forward_peer_message(msg);
+                return;
+            }
+            _message_ids.insert(msg.message_id, msg.message_sequence_number);
+            for (auto&& peer : _peers)
+                _peer_invalidations.add(peer, msg);
+        }
+
+        // thread for sending the invalidations gathered over each window, one batch message per destination
+        void flush_invalidations() {
+            uint64_t sent = 0, messages = 0;
+            while (1) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(_invalidation_window));
+                uint64_t now = InvalidationBatcher::milliseconds_now(), oldest = now, before = messages;
+                for (int peers = 0; peers < 2; peers++) {
+                    InvalidationBatcher &batcher = peers ? _peer_invalidations : _node_invalidations;
+                    for (auto&& x : batcher.take()) {
+                        std::vector<message> invalidations;
+                        for (auto&& p : x.second) {
+                            invalidations.push_back(p.msg);
+                            oldest = std::min(oldest, p.queued);
                         }
+                        message msg;
+                        msg.type = peers ? LINK_INVALIDATE_BATCH : NODE_INVALIDATE_BATCH;
+                        msg.text = _protocol.encode_batch(invalidations);
+                        if (peers)
+                            send_peer_link(x.first, msg, nullptr);
+                        else
+                            send_node_message(x.first, msg);
+                        sent += invalidations.size();
+                        messages++;
                     }
                 }
-                close(socket_fd);
+                if (messages > before) {
+                    log("invalidation batch", std::to_string(sent) + " invalidations in " + std::to_string(messages) +
+                        " messages so far, " + std::to_string(_node_invalidations.superseded + _peer_invalidations.superseded) +
+                        " superseded, oldest waited " + std::to_string(now - oldest) + " ms");
+                }
             }
         }
 
-        // remove id from all files in mapping
+        // remove id from all files it registered in mapping
         void files_index_cleanup(int id) {
-            std::unordered_map<std::string, std::vector<int>> tmp_files_index;
-            
-            std::lock_guard<std::mutex> guard(_files_index_m);
-            for (auto const &file_index : _files_index) {
-                std::vector<int> ids = file_index.second;
-                ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
-                if (ids.size() > 0)
-                    tmp_files_index[file_index.first] = ids;
-            }
-            _files_index = tmp_files_index;
+            _files_index.remove_id(id);
         }
 
         // searches local files index for filename
         std::string query_local_files_index(std::string filename) {
             std::ostringstream ids;
-            if (_files_index.count(filename) > 0) {
-                std::string delimiter;
-                std::lock_guard<std::mutex> guard(_files_index_m);
-                for (auto &&id : _files_index[filename]) {
-                    // add id to stream
-                    ids << delimiter << id;
-                    delimiter = ',';
-                }
+            std::string delimiter;
+            // searches copy the ids out under the lock of the filename's shard, so they only wait on registrations to that shard
+            for (auto &&id : _files_index.find(filename)) {
+                // add id to stream
+                ids << delimiter << id;
+                delimiter = ',';
             }
             return ids.str();
         }
 
         // searches all peers' files indexes for filename
+        // every neighbor is queried at once and replies are gathered until the query's deadline
         std::string query_peers_files_index(std::string filename, int id, int sequence_number, int ttl) {
             std::string ids;
             std::string delimiter;
-            // iteratively query each peer to search their files index
-            for (auto&& peer : _peers) {
-                int socket_fd = connect_server(peer);
-                if (socket_fd < 0) {
-                    log("failed peer connection", "ignoring connection");
+            // each hop waits one timeout longer than the peers it forwards to, so their answers arrive in time
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_query_hop_timeout * (ttl + 1));
+            std::vector<_peer_reply> replies = forward_peer_message(
+                peer_message(LINK_QUERY, ttl, id, sequence_number, filename, 0)
+            );
+            for (auto&& reply : replies) {
+                if (reply.ids.wait_until(deadline) != std::future_status::ready) {
+                    // a slow or dead peer only costs the deadline
+                    log("peer timed out", "ignoring reply from peer " + std::to_string(reply.peer), LOG_WARNING);
+                    cancel_peer_reply(reply.peer, reply.request_id);
                     continue;
                 }
-                if (send(socket_fd, "0", sizeof(char), 0) < 0)
-                    log("peer unresponsive", "ignoring request");
-                else {
-                    // send ttl value of current message
-                    if (send(socket_fd, "1", sizeof(char), 0) < 0)
-                        log("peer unresponsive", "ignoring request");
-                    else {
-                        // send ttl value of current message
-                        if (send(socket_fd, &ttl, sizeof(ttl), 0) < 0)
-                            log("peer unresponsive", "ignoring request");
-                        else {
-                            // send the id part of the message id
-                            if (send(socket_fd, &id, sizeof(id), 0) < 0)
-                                log("peer unresponsive", "ignoring request");
-                            else {
-                                // send the sequence number part of the message id
-                                if (send(socket_fd, &sequence_number, sizeof(sequence_number), 0) < 0)
-                                    log("peer unresponsive", "ignoring request");
-                                else {
-                                    char buffer[MAX_FILENAME_SIZE];
-                                    strcpy(buffer, filename.c_str());
-                                    // send the filename of the request
-                                    if (send(socket_fd, buffer, sizeof(buffer), 0) < 0)
-                                        log("peer unresponsive", "ignoring request");
-                                    else {
-                                        if (!send_message_id(socket_fd, id, sequence_number))
-                                            log("peer unresponsive", "ignoring request");
-                                        else {
-                                            std::string msg = "msg id [" + std::to_string(id) + "," +
-                                                    std::to_string(sequence_number) + "] to peer " + std::to_string(peer);
-                                            log("forwarding message", msg);
-                                            char buffer_[MAX_MSG_SIZE];
-                                            // get the list of ids from the peer
-                                            if (recv(socket_fd, buffer_, sizeof(buffer_), 0) < 0)
-                                                log("peer unresponsive", "ignoring request");
-                                            else if (buffer_[0]) {
-                                                // add the list of ids to our 'global' list of all ids for this query
-                                                ids += delimiter + std::string(buffer_);
-                                                delimiter = ',';
-                                            }
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
+                std::string peer_ids = reply.ids.get();
+                if (!peer_ids.empty()) {
+                    // add the list of ids to our 'global' list of all ids for this query
+                    ids += delimiter + peer_ids;
+                    delimiter = ',';
                 }
-                close(socket_fd);
             }
             return ids;
         }
 
         // broadcast comparison message to all neighbor peers
-        void compare_peers(std::string filename, int id, int sequence_number, int ttl, time_t version) {
+        void compare_peers(std::string filename, int id, int sequence_number, int ttl, time_t version, uint64_t hash) {
+            forward_peer_message(peer_message(LINK_COMPARE, ttl, id, sequence_number, filename, version, hash));
+        }
+
+        // helper function for building a message flooded between super peers, identified by its origin
+        message peer_message(int type, int ttl, int id, int sequence_number, std::string filename, time_t version, uint64_t hash=0) {
+            message msg;
+            msg.type = type;
+            msg.ttl = ttl;
+            msg.id = id;
+            msg.sequence_number = sequence_number;
+            msg.filename = filename;
+            msg.version = version;
+            msg.hash = hash;
+            msg.message_id = id;
+            msg.message_sequence_number = sequence_number;
+            return msg;
+        }
+
+        // send a message to every neighbor peer over its pooled link, or on a connection of its own in legacy networks
+        // returns a pending reply per peer for queries, which is empty if the peer could not answer
+        std::vector<_peer_reply> forward_peer_message(message msg) {
+            std::vector<_peer_reply> replies;
+
+            // add the message id to the global message ids list
+            _message_ids.insert(msg.message_id, msg.message_sequence_number);
+
             for (auto&& peer : _peers) {
-                int socket_fd = connect_server(peer);
-                if (socket_fd < 0) {
-                    log("failed peer connection", "ignoring connection");
+                // only forward queries to peers which might be able to find the file within the remaining ttl
+                if (msg.type == LINK_QUERY && !summary_might_reach(peer, msg.filename, msg.ttl)) {
+                    log("skipping peer", "msg id [" + std::to_string(msg.id) + "," + std::to_string(msg.sequence_number) +
+                                         "] not in summary of peer " + std::to_string(peer), LOG_DEBUG);
                     continue;
                 }
-                if (send(socket_fd, "0", sizeof(char), 0) < 0)
-                    log("peer unresponsive", "ignoring request");
-                else {
-                    if (send(socket_fd, "3", sizeof(char), 0) < 0)
-                        log("peer unresponsive", "ignoring request");
-                    else {
-                        // send ttl value of current message
-                        if (send(socket_fd, &ttl, sizeof(ttl), 0) < 0)
-                            log("peer unresponsive", "ignoring request");
-                        else {
-                            // send the id part of the message id
-                            if (send(socket_fd, &id, sizeof(id), 0) < 0)
-                                log("peer unresponsive", "ignoring request");
-                            else {
-                                // send the sequence number part of the message id
-                                if (send(socket_fd, &sequence_number, sizeof(sequence_number), 0) < 0)
-                                    log("peer unresponsive", "ignoring request");
-                                else {
-                                    char buffer[MAX_FILENAME_SIZE];
-                                    strcpy(buffer, filename.c_str());
-                                    // send the filename of the request
-                                    if (send(socket_fd, buffer, sizeof(buffer), 0) < 0)
-                                        log("peer unresponsive", "ignoring request");
-                                    else {
-                                        // send version of the file of the request
-                                        if (send(socket_fd, &version, sizeof(version), 0) < 0)
-                                            log("peer unresponsive", "ignoring request");
-                                        else {
-                                            if (!send_message_id(socket_fd, id, sequence_number))
-                                                log("peer unresponsive", "ignoring request");
-                                            else {
-                                                std::string msg = "msg id [" + std::to_string(id) +
-                                                                "," + std::to_string(sequence_number) +
-                                                                "] to peer " + std::to_string(peer);
-                                                log("forwarding message", msg);
-                                            }
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-                close(socket_fd);
+                _peer_reply reply;
+                reply.peer = peer;
+                _peer_reply *pending = (msg.type == LINK_QUERY) ? &reply : nullptr;
+                if (!((_protocol.wire_format == LEGACY) ? send_peer_request(peer, msg, pending) : send_peer_link(peer, msg, pending)))
+                    continue;
+                std::string log_msg = "msg id [" + std::to_string(msg.id) + "," +
+                                      std::to_string(msg.sequence_number) + "] to peer " + std::to_string(peer);
+                log("forwarding message", log_msg, LOG_DEBUG);
+                if (msg.type == LINK_QUERY)
+                    replies.push_back(std::move(reply));
             }
+            return replies;
         }
 
-        // helper function for sending the parts of a message id
-        bool send_message_id(int socket_fd, int id, int sequence_number) {
-            if (send(socket_fd, &id, sizeof(id), 0) < 0)
+        // write a single message to a neighbor peer's pooled link, opening the link if needed
+        // if reply is given it receives the request id and future for the peer's answer
+        bool send_peer_link(int peer, message msg, _peer_reply *reply) {
+            _peer_link &link = *_peer_links.at(peer);
+            std::lock_guard<std::mutex> guard(link.send_m);
+            if (link.socket_fd < 0 && !open_peer_link(link)) {
+                log("failed peer connection", "ignoring connection", LOG_WARNING);
                 return false;
+            }
 
-            if (send(socket_fd, &sequence_number, sizeof(sequence_number), 0) < 0)
+            msg.request_id = ++_request_id;
+            if (reply != nullptr) {
+                std::lock_guard<std::mutex> pending_guard(link.pending_m);
+                _pending_reply &pending = link.pending[msg.request_id];
+                pending.socket_fd = link.socket_fd;
+                reply->request_id = msg.request_id;
+                reply->ids = pending.reply.get_future();
+            }
+
+            if (!_protocol.send_message(link.socket_fd, msg)) {
+                log("peer unresponsive", "ignoring request", LOG_WARNING);
+                // wake up the link's reader so it tears the link down and fails any other pending replies
+                shutdown(link.socket_fd, SHUT_RDWR);
+                if (reply != nullptr) {
+                    std::lock_guard<std::mutex> pending_guard(link.pending_m);
+                    auto it = link.pending.find(msg.request_id);
+                    if (it != link.pending.end()) {
+                        it->second.reply.set_value("");
+                        link.pending.erase(it);
+                    }
+                }
                 return false;
-            
-            std::lock_guard<std::mutex> guard(_message_ids_m);
-            // add the message id and the time it was requested to the global message ids list
-            _message_ids[{id, sequence_number}] = std::chrono::system_clock::now();
+            }
             return true;
         }
 
-        // checks if message was already seen/forwarded
-        bool check_message_id(int socket_fd) {
-            int id;
-            // get id part of message id
-            if (recv(socket_fd, &id, sizeof(id), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
+        // send a single message to a neighbor peer on a connection of its own, the way legacy peers expect
+        // pooled links and request ids do not exist in the legacy wire format, so a query's reply is read by a
+        // thread of its own, which still lets every neighbor be queried at once
+        bool send_peer_request(int peer, message msg, _peer_reply *reply) {
+            msg.type = (msg.type == LINK_QUERY) ? PEER_QUERY : (msg.type == LINK_INVALIDATE) ? PEER_INVALIDATE : PEER_COMPARE;
+            int socket_fd = connect_server(peer, _query_hop_timeout);
+            if (socket_fd < 0) {
+                log("failed peer connection", "ignoring connection", LOG_WARNING);
                 return false;
             }
+            if (!_protocol.send_message(socket_fd, msg)) {
+                log("peer unresponsive", "ignoring request", LOG_WARNING);
+                close(socket_fd);
+                return false;
+            }
+            if (reply == nullptr) {
+                close(socket_fd);
+                return true;
+            }
+
+            std::shared_ptr<std::promise<std::string>> ids(new std::promise<std::string>());
+            reply->request_id = 0;
+            reply->ids = ids->get_future();
+            // the reply is only waited on for as long as the query's deadline
+            int timeout = _query_hop_timeout * (msg.ttl + 1);
+            std::thread r_t([this, socket_fd, ids, timeout]{
+                message peer_reply;
+                bool answered = wait_socket(socket_fd, POLLIN, timeout) && _protocol.recv_reply(socket_fd, PEER_REPLY, peer_reply);
+                ids->set_value(answered ? peer_reply.text : "");
+                close(socket_fd);
+            });
+            r_t.detach();
+            return true;
+        }
+
+        // stop waiting on a reply which missed its deadline
+        void cancel_peer_reply(int peer, uint32_t request_id) {
+            // a legacy reply's thread gives up on its own at the same deadline
+            if (_protocol.wire_format == LEGACY)
+                return;
+            _peer_link &link = *_peer_links.at(peer);
+            std::lock_guard<std::mutex> guard(link.pending_m);
+            link.pending.erase(request_id);
+        }
 
-            int sequence_number;
-            // get sequence number of message id
-            if (recv(socket_fd, &sequence_number, sizeof(sequence_number), 0) < 0) {
-                log("peer unresponsive", "ignoring request");
+        // connect to a neighbor peer and start reading replies from it
+        // expects the link's send lock to be held
+        bool open_peer_link(_peer_link &link) {
+            // back off from a peer which just refused a connection instead of paying the timeout on every message
+            auto now = std::chrono::steady_clock::now();
+            if (now < link.retry_time)
                 return false;
+            int socket_fd = connect_server(link.peer, _query_hop_timeout);
+            if (socket_fd < 0) {
+                link.retry_time = now + std::chrono::milliseconds(_query_hop_timeout);
+                return false;
+            }
+            message msg;
+            msg.type = PEER_LINK_CONNECT;
+            if (!_protocol.send_message(socket_fd, msg)) {
+                close(socket_fd);
+                return false;
+            }
+            link.socket_fd = socket_fd;
+            std::thread r_t(&SuperPeer::read_peer_link, this, &link, socket_fd);
+            r_t.detach();
+            return true;
+        }
+
+        // match replies on a pooled link to the requests waiting on them until the link fails
+        void read_peer_link(_peer_link *link, int socket_fd) {
+            message reply;
+            while (_protocol.recv_reply(socket_fd, LINK_REPLY, reply)) {
+                std::lock_guard<std::mutex> guard(link->pending_m);
+                auto it = link->pending.find(reply.request_id);
+                if (it != link->pending.end()) {
+                    it->second.reply.set_value(reply.text);
+                    link->pending.erase(it);
+                }
             }
 
-            _message_id_t msg_id = {id, sequence_number};
-            std::lock_guard<std::mutex> guard(_message_ids_m);
-            if (_message_ids.find(msg_id) == _message_ids.end()) {
-                // add message id to global list if not found
-                _message_ids[msg_id] = std::chrono::system_clock::now();
-                return true;
+            // stop new messages from using the failed socket, the next one reconnects
+            std::unique_lock<std::mutex> lock(link->send_m);
+            if (link->socket_fd == socket_fd)
+                link->socket_fd = -1;
+            // any request still waiting on this socket will never be answered
+            {
+                std::lock_guard<std::mutex> guard(link->pending_m);
+                for (auto it = link->pending.begin(); it != link->pending.end();) {
+                    if (it->second.socket_fd == socket_fd) {
+                        it->second.reply.set_value("");
+                        it = link->pending.erase(it);
+                    }
+                    else
+                        it++;
+                }
             }
-            log("message already seen", "rerouting message back to sender");
+            // only close once nothing refers to the descriptor, it may be reused by the next link
+            close(socket_fd);
+            lock.unlock();
+            log("peer disconnected", "closed pooled connection to peer " + std::to_string(link->peer), LOG_DEBUG);
+        }
+
+        // checks if message was already seen/forwarded
+        bool check_message_id(int id, int sequence_number) {
+            // add message id to global list if not found
+            if (_message_ids.insert(id, sequence_number))
+                return true;
+            log("message already seen", "rerouting message back to sender", LOG_DEBUG);
             return false;
         }
         
         // handles communication with node for returning all ids mapped to a filename
-        void node_search(int socket_fd, int id) {
-            char buffer[MAX_FILENAME_SIZE];
-            // recieve filename from node
-            if (recv(socket_fd, buffer, sizeof(buffer), 0) < 0) {
-                remove_node(socket_fd, id, "node unresponsive");
-                return;
-            }
-
-            _sequence_number += 1;
+        bool node_search(int socket_fd, int id, std::string filename) {
+            int sequence_number = ++_sequence_number;
             // get ids from local files index
-            std::string ids = query_local_files_index(buffer);
+            std::string ids = query_local_files_index(filename);
             // get all nodes ids from all neighbor peers' files indexes
-            std::string peers_ids = query_peers_files_index(buffer, id, _sequence_number, _ttl);
+            std::string peers_ids = query_peers_files_index(filename, id, sequence_number, _ttl);
             if (!peers_ids.empty())
                 ids += ((!ids.empty()) ? "," : "") + peers_ids;
             
-            char buffer_[MAX_MSG_SIZE];
-            strcpy(buffer_, ids.c_str());
+            message reply;
+            reply.type = SEARCH_REPLY;
+            reply.text = ids;
             // send comma delimited list of all ids for a specific file to the node
-            if (send(socket_fd, buffer_, sizeof(buffer_), 0) < 0) {
+            if (!_protocol.send_message(socket_fd, reply)) {
                 remove_node(socket_fd, id, "node unresponsive");
-                return;
+                return false;
             }
+            return true;
         }
 
         // helper function for displaying the entire files index
         void print_files_map() {
-            std::lock_guard<std::mutex> guard(_files_index_m);
             std::cout << "\n__________FILES INDEX__________" << std::endl;
-            for (auto const &file_index : _files_index) {
-                std::cout << file_index.first << ':';
+            _files_index.for_each([](const std::string &filename, const std::vector<int> &ids) {
+                std::cout << filename << ':';
                 std::string delimiter;
-                for (auto &&id : file_index.second) {
+                for (auto &&id : ids) {
                     std::cout << delimiter << id;
                     delimiter = ',';
                 }
                 std::cout << std::endl;
-            }
+            });
+            std::cout << "__________SUBSCRIPTIONS________" << std::endl;
+            _subscriptions.for_each([](const std::string &filename, int origin, const std::unordered_set<int> &nodes) {
+                std::cout << origin << '/' << filename << ':';
+                std::string delimiter;
+                for (auto &&node : nodes) {
+                    std::cout << delimiter << node;
+                    delimiter = ',';
+                }
+                std::cout << std::endl;
+            });
             std::cout << "_______________________________\n" << std::endl;
         }
 
         // helper function for displaying all message ids currently being tracked
         void print_message_ids_list() {
-            std::lock_guard<std::mutex> guard(_files_index_m);
             std::cout << "\n__________MESSAGE IDS__________" << std::endl;
-            for (auto const &message_id : _message_ids) {
-                std::cout << '[' << message_id.first.first << ',' << message_id.first.second << "]" << std::endl;
-            }
+            _message_ids.for_each([](int id, int sequence_number) {
+                std::cout << '[' << id << ',' << sequence_number << "]" << std::endl;
+            });
             std::cout << "_______________________________\n" << std::endl;
         }
 
@@ -792,8 +844,9 @@ class SuperPeer {
         void print_modified_files_list() {
             std::cout << "\n__________MODIFIED FILES__________" << std::endl;
             std::cout << "[filename] [origin node] [version]" << std::endl;
+            std::lock_guard<std::mutex> guard(_modified_files_m);
             for (auto &&x : _modified_files)
-                std::cout << '[' << x.name << "] [" << x.id << "] [" << x.version << ']' << std::endl;
+                std::cout << '[' << x.first.second << "] [" << x.first.first << "] [" << x.second.first << ']' << std::endl;
             std::cout << "__________________________________\n" << std::endl;
         }
 
@@ -806,6 +859,9 @@ class SuperPeer {
             int port;
             std::string peers;
             std::string nodes;
+            std::string key;
+            std::string value;
+            bool found = false;
 
             config >> _consistency_method;
             if (_consistency_method == PULL_N || _consistency_method == PULL_P) {
@@ -822,25 +878,92 @@ class SuperPeer {
                         _port = port;
                         _peers = comma_delim_ints_to_vector(peers);
                         _nodes = comma_delim_ints_to_vector(nodes);
-                        return;
+                        found = true;
                     }
                 }
+                else if (member_type == 2) {
+                    // optional settings shared by the whole network
+                    config >> key >> value;
+                    _options[key] = value;
+                }
                 else
                     std::getline(config, tmp); // ignore anything else in the line
             }
-            error("invalid id");
+            if (!found)
+                error("invalid id");
         }
 
-        // thread which continously runs, checking for old messages and removing them
-        void maintain_message_ids() {
-            while (1) {
-                // wait 1 minute to check messages list
-                sleep(60);
-                std::lock_guard<std::mutex> guard(_message_ids_m);
-                for (auto itr = _message_ids.cbegin(); itr != _message_ids.cend();) {
-                    // remove messages if they were recorded longer than a minute ago
-                    itr = (std::chrono::duration_cast<std::chrono::minutes>(std::chrono::system_clock::now() -
-                                                        itr->second).count() > 1) ? _message_ids.erase(itr++) : ++itr;
+        // gets an optional setting from the config file, or the default if it was not set
+        std::string option(std::string key, std::string default_value) {
+            auto it = _options.find(key);
+            return (it != _options.end()) ? it->second : default_value;
+        }
+
+        int int_option(std::string key, int default_value) {
+            auto it = _options.find(key);
+            return (it != _options.end()) ? atoi(it->second.c_str()) : default_value;
+        }
+
+        // routing summary last received from a neighbor peer, or nullptr if there is none recent enough to trust
+        // expects the summaries lock to be held
+        const RoutingSummary *peer_summary(int peer) {
+            auto it = _peer_summaries.find(peer);
+            if (it == _peer_summaries.end() || std::chrono::steady_clock::now() - it->second.received >
+                                               std::chrono::milliseconds(_summary_interval * SUMMARY_EXPIRY_INTERVALS))
+                return nullptr;
+            return &it->second.summary;
+        }
+
+        // checks if a query with ttl hops left could find filename through a neighbor peer
+        // peers without a summary are always asked
+        bool summary_might_reach(int peer, std::string filename, int ttl) {
+            std::lock_guard<std::mutex> guard(_peer_summaries_m);
+            const RoutingSummary *summary = peer_summary(peer);
+            return summary == nullptr || summary->might_reach(filename, ttl);
+        }
+
+        void store_peer_summary(message &msg) {
+            RoutingSummary summary;
+            if (std::find(_peers.begin(), _peers.end(), msg.id) == _peers.end() || !summary.decode(msg.text)) {
+                log("invalid summary", "ignoring summary from peer " + std::to_string(msg.id), LOG_WARNING);
+                return;
+            }
+            std::lock_guard<std::mutex> guard(_peer_summaries_m);
+            _peer_summaries[msg.id] = {summary, std::chrono::steady_clock::now()};
+        }
+
+        // thread which periodically sends each neighbor peer a summary of the files reachable through this peer
+        // a summary is only sent when it changed, so an idle network exchanges next to nothing
+        void exchange_summaries() {
+            std::unordered_map<int, std::string> sent; // last summary sent to each neighbor peer
+            for (int interval = 1; ; interval++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(_summary_interval));
+                BloomFilter local(_summary_bits, SUMMARY_HASHES);
+                _files_index.for_each([&local](const std::string &filename, const std::vector<int> &) {
+                    local.add(filename);
+                });
+
+                bool refresh = interval % SUMMARY_REFRESH_INTERVALS == 0;
+                for (auto&& peer : _peers) {
+                    message msg;
+                    msg.type = LINK_SUMMARY;
+                    msg.id = _port;
+                    {
+                        // leave out what the peer itself advertised, it already knows about its own files
+                        std::lock_guard<std::mutex> guard(_peer_summaries_m);
+                        std::vector<const RoutingSummary *> neighbors;
+                        for (auto&& neighbor : _peers) {
+                            if (neighbor != peer)
+                                neighbors.push_back(peer_summary(neighbor));
+                        }
+                        msg.text = RoutingSummary::build(local, neighbors, _ttl + 1).encode();
+                    }
+                    if (!refresh && sent[peer] == msg.text)
+                        continue;
+                    if (send_peer_link(peer, msg, nullptr))
+                        sent[peer] = msg.text;
+                    else
+                        sent.erase(peer);
                 }
             }
         }
@@ -849,18 +972,238 @@ class SuperPeer {
         void check_peers() {
             while (1) {
                 sleep(_ttr);
-                std::lock_guard<std::mutex> guard(_modified_files_m);
-                for (auto&& x: _modified_files) {
-                    // only compare files with local nodes if the file exists in the mapping
-                    if (_files_index.find(x.name) != _files_index.end())
-                        compare_nodes(x.id, x.name, x.version);
-                    compare_peers(x.name, x.id, ++_sequence_number, _ttl, x.version);
+                // take the modified files and release the lock right away, so registrations never wait on the comparisons
+                std::map<std::pair<int, std::string>, std::pair<time_t, uint64_t>> modified;
+                {
+                    std::lock_guard<std::mutex> guard(_modified_files_m);
+                    modified.swap(_modified_files);
+                }
+                // comparisons are queued on the forwarding threads so a slow peer never pushes back the next ttr,
+                // without starting a thread for every modified file
+                for (auto&& x : modified) {
+                    int id = x.first.first, sequence_number = ++_sequence_number;
+                    std::string filename = x.first.second;
+                    time_t version = x.second.first;
+                    uint64_t hash = x.second.second;
+                    _forwarding.submit([this, id, filename, version, hash, sequence_number]{
+                        compare_modified_file(id, filename, version, hash, sequence_number);
+                    });
                 }
-                // clear the modified files after any cached versions have been invalidated across the network
-                _modified_files.clear();
             }
         }
 
+        // compare a single modified file with cached copies in local leaf nodes and across neighbor peers
+        void compare_modified_file(int id, std::string filename, time_t version, uint64_t hash, int sequence_number) {
+            // only leaf nodes caching the file are sent the modified version
+            invalidate_nodes(id, filename, version, hash);
+            compare_peers(filename, id, sequence_number, _ttl, version, hash);
+        }
+
+        // accept every pending connection and hand them out to the reactors
+        void accept_connections() {
+            struct sockaddr_in addr;
+            socklen_t addr_size = sizeof(addr);
+            int socket_fd;
+
+            while ((socket_fd = accept4(_socket_fd, (struct sockaddr*)&addr, &addr_size, SOCK_NONBLOCK)) >= 0) {
+                std::ostringstream connection;
+                connection << inet_ntoa(addr.sin_addr) << '@' << ntohs(addr.sin_port);
+                log("conn established", connection.str(), LOG_DEBUG);
+
+                int epoll_fd = _epoll_fds[_next_reactor++ % _epoll_fds.size()];
+                _connection *conn = new _connection{socket_fd, epoll_fd, -1, nullptr};
+                struct epoll_event event;
+                event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+                event.data.ptr = conn;
+                if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket_fd, &event) < 0) {
+                    log("failed connection", "ignoring connection", LOG_WARNING);
+                    close(socket_fd);
+                    delete conn;
+                }
+                addr_size = sizeof(addr);
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                log("failed connection", "ignoring connection", LOG_WARNING);
+        }
+
+        // re-arm a one-shot socket so its reactor reports the next request
+        void rearm_connection(_connection *conn) {
+            struct epoll_event event;
+            event.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+            event.data.ptr = conn;
+            if (epoll_ctl(conn->epoll_fd, EPOLL_CTL_MOD, conn->socket_fd, &event) < 0) {
+                if (conn->session)
+                    log("peer disconnected", "closed pooled connection", LOG_DEBUG);
+                else
+                    remove_node(conn->socket_fd, conn->id, "node unresponsive");
+                delete conn;
+            }
+        }
+
+        // runs on a worker when a reactor reports a readable socket
+        // workers only read requests and run what never waits on another server, the rest is handed to the forwarding threads
+        void handle_event(_connection *conn) {
+            // requests on a pooled link run on this worker once the socket is re-armed for the next one
+            if (conn->session) {
+                std::shared_ptr<_peer_session> session = conn->session;
+                message msg;
+                int status = _protocol.recv_message(session->socket_fd, PEER_LINK, msg);
+                if (status == MSG_NONE) {
+                    rearm_connection(conn);
+                    return;
+                }
+                if (status != MSG_OK) {
+                    log("peer disconnected", "closed pooled connection", LOG_DEBUG);
+                    delete conn; // the socket is closed once every request still running on it is done
+                    return;
+                }
+                rearm_connection(conn);
+                _forwarding.submit([this, session, msg]{ reply_peer_link(session, msg); });
+                return;
+            }
+
+            // the first message of a connection decides whether it is a peer or a node
+            if (conn->id < 0) {
+                message msg;
+                int status = _protocol.recv_message(conn->socket_fd, SUPER_PEER_CONNECTION, msg);
+                if (status == MSG_NONE) {
+                    rearm_connection(conn);
+                    return;
+                }
+                if (status != MSG_OK) {
+                    log("conn unidentified", "closing connection", LOG_WARNING);
+                    close(conn->socket_fd);
+                    delete conn;
+                    return;
+                }
+
+                switch (msg.type) {
+                    case NODE_CONNECT:
+                        conn->id = msg.id;
+                        rearm_connection(conn);
+                        return;
+                    case PEER_LINK_CONNECT:
+                        conn->session.reset(new _peer_session(conn->socket_fd));
+                        log("peer connected", "opened pooled connection", LOG_DEBUG);
+                        rearm_connection(conn);
+                        return;
+                    default: {
+                        // peer requests are a single message which closes the socket when done
+                        int socket_fd = conn->socket_fd;
+                        _forwarding.submit([this, socket_fd, msg]() mutable { handle_peer_request(socket_fd, msg); });
+                        delete conn;
+                        return;
+                    }
+                }
+            }
+
+            message msg;
+            switch (_protocol.recv_message(conn->socket_fd, NODE_LINK, msg)) {
+                case MSG_NONE:
+                    rearm_connection(conn);
+                    return;
+                case MSG_CLOSED:
+                    remove_node(conn->socket_fd, conn->id, "node disconnected");
+                    delete conn;
+                    return;
+                case MSG_ERROR:
+                    remove_node(conn->socket_fd, conn->id, "node unresponsive");
+                    delete conn;
+                    return;
+            }
+            // searches and changes which may reach other peers and nodes wait on them, so they run on the forwarding
+            // threads, and the socket is only re-armed once they are done so a node's requests stay in order
+            if (msg.type == SEARCH || msg.type == DEREGISTRY || msg.type == REGISTRY_BATCH) {
+                _forwarding.submit([this, conn, msg]() mutable { finish_node_message(conn, msg); });
+                return;
+            }
+            finish_node_message(conn, msg);
+        }
+
+        // run a node's request, then wait for its next one unless the connection was closed
+        void finish_node_message(_connection *conn, message &msg) {
+            if (process_node_message(conn->socket_fd, conn->id, msg))
+                rearm_connection(conn);
+            else
+                delete conn;
+        }
+
+        // event loop for a single reactor, queueing ready sockets onto the worker pool
+        void reactor(int epoll_fd) {
+            struct epoll_event events[MAX_EVENTS];
+            while (1) {
+                int n = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+                for (int i = 0; i < n; i++) {
+                    _connection *conn = (_connection *)events[i].data.ptr;
+                    // the listening socket is registered without any connection state
+                    if (conn == nullptr)
+                        accept_connections();
+                    else
+                        _workers.submit([this, conn]{ handle_event(conn); });
+                }
+            }
+        }
+
+        // thread-per-connection server loop
+        void run_threads() {
+            struct sockaddr_in addr;
+            socklen_t addr_size = sizeof(addr);
+            int socket_fd;
+
+            std::ostringstream connection;
+            while (1) {
+                if ((socket_fd = accept(_socket_fd, (struct sockaddr*)&addr, &addr_size)) < 0) {
+                    // ignore any failed connections from nodes
+                    log("failed connection", "ignoring connection", LOG_WARNING);
+                    continue;
+                }
+
+                connection << inet_ntoa(addr.sin_addr) << '@' << ntohs(addr.sin_port);
+                log("conn established", connection.str(), LOG_DEBUG);
+                
+                // start thread for single client-server communication
+                std::thread t(&SuperPeer::handle_connection, this, socket_fd);
+                t.detach(); // detaches thread and allows for next connection to be made without waiting
+
+                connection.str("");
+                connection.clear();
+            }
+        }
+
+        // event driven server loop, a few epoll reactors own every socket and feed a fixed worker pool
+        void run_reactor() {
+            // every leaf node holds a socket open, so allow as many descriptors as the system will
+            struct rlimit limit;
+            if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+                limit.rlim_cur = limit.rlim_max;
+                setrlimit(RLIMIT_NOFILE, &limit);
+            }
+
+            fcntl(_socket_fd, F_SETFL, fcntl(_socket_fd, F_GETFL, 0) | O_NONBLOCK);
+
+            int reactors = std::max(1, int_option("reactor_threads", 1));
+            for (int i = 0; i < reactors; i++) {
+                int epoll_fd = epoll_create1(0);
+                if (epoll_fd < 0)
+                    error("failed reactor creation");
+                _epoll_fds.push_back(epoll_fd);
+            }
+            _workers.start(std::max(1, int_option("worker_threads", 4 * (int)std::thread::hardware_concurrency())));
+
+            // the first reactor also accepts new connections
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = nullptr;
+            if (epoll_ctl(_epoll_fds[0], EPOLL_CTL_ADD, _socket_fd, &event) < 0)
+                error("failed reactor creation");
+
+            for (int i = 1; i < reactors; i++) {
+                std::thread r_t(&SuperPeer::reactor, this, _epoll_fds[i]);
+                r_t.detach();
+            }
+            reactor(_epoll_fds[0]);
+        }
+
     public:
         int _ttl;
         int _id;
@@ -868,11 +1211,34 @@ class SuperPeer {
         int _socket_fd;
         int _consistency_method;
         int _ttr;
-        int _sequence_number = 0;
+        int _io_model;
+        int _query_hop_timeout; // milliseconds a query waits on neighbors for each remaining hop
+        int _summary_interval; // milliseconds between routing summary updates, 0 (default) floods every query
+        int _summary_bits;
+        int _invalidation_window; // milliseconds invalidations are gathered for, 0 sends each one right away
+        std::atomic<int> _sequence_number{0};
 
         SuperPeer(int id, std::string config_path) {
             _id = id;
             get_network(config_path);
+            _io_model = (option("io_model", "threads") == "reactor") ? REACTOR : THREADS;
+            _query_hop_timeout = std::max(1, int_option("query_hop_timeout", 1000));
+            _summary_interval = std::max(0, int_option("summary_interval", 0));
+            _summary_bits = std::max(64, int_option("summary_bits", SUMMARY_BITS));
+            _protocol.wire_format = (option("wire_format", "framed") == "legacy") ? LEGACY : FRAMED;
+            // batches do not fit the legacy wire format, so legacy networks send every invalidation on its own
+            _invalidation_window = (_protocol.wire_format == FRAMED) ? std::max(0, int_option("invalidation_window", INVALIDATION_WINDOW)) : 0;
+            struct hostent *server = gethostbyname(HOST);
+            if (server == nullptr)
+                error("failed host lookup");
+            bzero((char *)&_host_addr, sizeof(_host_addr));
+            _host_addr.sin_family = AF_INET;
+            bcopy((char *)server->h_addr, (char *)&_host_addr.sin_addr.s_addr, server->h_length);
+
+            for (auto&& peer : _peers) {
+                _peer_links[peer] = std::unique_ptr<_peer_link>(new _peer_link());
+                _peer_links[peer]->peer = peer;
+            }
 
             struct sockaddr_in addr;
             socklen_t addr_size = sizeof(addr);
@@ -888,10 +1254,17 @@ class SuperPeer {
             if (bind(_socket_fd, (struct sockaddr*)&addr, addr_size) < 0)
                 error("failed server binding");
 
+            // listen once for any peer or node connections to start communication
+            if (listen(_socket_fd, SOMAXCONN) < 0)
+                error("failed server listen");
+
             std::cout << "starting indexing server on port " << _port << '\n' << std::endl;
 
-            // start logging
-            _server_logs.open("logs/super_peers/" + std::to_string(_port) + ".log");
+            // start logging, every line is written to the log file and echoed to stdout unless configured otherwise
+            _server_log = _logger.open("logs/super_peers/" + std::to_string(_port) + ".log",
+                                       Logger::level(option("log_level", "debug"), LOG_DEBUG));
+            _logger.echo(Logger::level(option("log_stdout", "debug"), LOG_DEBUG));
+            _logger.start();
         }
 
         std::vector<int> comma_delim_ints_to_vector(std::string s) {
@@ -908,13 +1281,7 @@ class SuperPeer {
         }
 
         void run() {
-            struct sockaddr_in addr;
-            socklen_t addr_size = sizeof(addr);
-            int socket_fd;
-
-            // start thread for maintaining messages list
-            std::thread m_t(&SuperPeer::maintain_message_ids, this);
-            m_t.detach();
+            _forwarding.start(std::max(1, int_option("forwarding_threads", FORWARDING_THREADS)));
 
             // start thread for maintaining modified files list if using the PULL FROM PEERS consistency method
             if (_consistency_method == PULL_P) {
@@ -922,33 +1289,25 @@ class SuperPeer {
                 f_t.detach();
             }
 
+            // routing summaries do not fit the legacy wire format, so legacy networks keep flooding every query
+            if (_summary_interval > 0 && _protocol.wire_format == FRAMED) {
+                std::thread s_t(&SuperPeer::exchange_summaries, this);
+                s_t.detach();
+            }
 
-            std::ostringstream connection;
-            while (1) {
-                // listen for any peer connections to start communication
-                listen(_socket_fd, 5);
-
-                if ((socket_fd = accept(_socket_fd, (struct sockaddr*)&addr, &addr_size)) < 0) {
-                    // ignore any failed connections from nodes
-                    log("failed connection", "ignoring connection");
-                    continue;
-                }
-
-                connection << inet_ntoa(addr.sin_addr) << '@' << ntohs(addr.sin_port);
-                log("conn established", connection.str());
-                
-                // start thread for single client-server communication
-                std::thread t(&SuperPeer::handle_connection, this, socket_fd);
-                t.detach(); // detaches thread and allows for next connection to be made without waiting
-
-                connection.str("");
-                connection.clear();
+            if (_invalidation_window > 0) {
+                std::thread i_t(&SuperPeer::flush_invalidations, this);
+                i_t.detach();
             }
+
+            if (_io_model == REACTOR)
+                run_reactor();
+            else
+                run_threads();
         }
 
         ~SuperPeer() {
             close(_socket_fd);
-            _server_logs.close();
         }
 };
 
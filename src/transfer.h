@@ -0,0 +1,137 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+
+#include <algorithm>
+
+#include "protocol.h"
+
+
+#define SPLICE_PIPE_SIZE (1024 * 1024) // bytes a receive pipe holds, so each splice moves more than the default 64 KB
+
+
+// file contents sent after an obtain reply, with every size and offset kept in 64 bits so files over 2 GB
+// transfer the same as small ones
+
+// send length bytes of a file starting at offset, returning false if the connection fails first
+inline bool send_file_range(int socket_fd, int fd, int64_t offset, int64_t length) {
+    off_t position = offset;
+    while (length > 0) {
+        ssize_t sent_size = sendfile(socket_fd, fd, &position, std::min<int64_t>(length, MAX_MSG_SIZE));
+        if (sent_size < 0 && errno == EINTR)
+            continue;
+        if (sent_size <= 0)
+            return false;
+        length -= sent_size;
+    }
+    return true;
+}
+
+// receive up to length bytes into a file starting at offset by copying them through a buffer
+// returns how many bytes were written, which is less than length if the connection closed early
+inline int64_t recv_file_copy(int socket_fd, int fd, int64_t offset, int64_t length) {
+    char buffer[MAX_MSG_SIZE];
+    int64_t received = 0;
+    while (received < length) {
+        ssize_t received_size = recv(socket_fd, buffer, std::min<int64_t>(sizeof(buffer), length - received), 0);
+        if (received_size < 0 && errno == EINTR)
+            continue;
+        if (received_size <= 0)
+            break;
+        for (ssize_t written = 0; written < received_size;) {
+            ssize_t written_size = pwrite(fd, buffer + written, received_size - written, offset + received + written);
+            if (written_size <= 0)
+                return received;
+            written += written_size;
+        }
+        received += received_size;
+    }
+    return received;
+}
+
+// receive up to length bytes into a file starting at offset by splicing them from the socket through a pipe,
+// so the data never passes through user space
+// supported is cleared if either descriptor cannot be spliced, the rest is then left to recv_file_copy
+inline int64_t recv_file_splice(int socket_fd, int fd, int64_t offset, int64_t length, bool &supported) {
+    int pipe_fd[2];
+    supported = pipe2(pipe_fd, O_CLOEXEC) == 0;
+    if (!supported)
+        return 0;
+    fcntl(pipe_fd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    int64_t received = 0;
+    while (received < length) {
+        ssize_t in_size = splice(socket_fd, nullptr, pipe_fd[1], nullptr, std::min<int64_t>(length - received, SPLICE_PIPE_SIZE),
+                                 SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in_size < 0 && errno == EINTR)
+            continue;
+        if (in_size < 0 && errno == EINVAL)
+            supported = false;
+        if (in_size <= 0)
+            break;
+        // empty the pipe into the file before taking more from the socket
+        while (in_size > 0) {
+            loff_t position = offset + received;
+            ssize_t out_size = splice(pipe_fd[0], nullptr, fd, &position, in_size, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (out_size < 0 && errno == EINTR)
+                continue;
+            if (out_size <= 0) {
+                // the file cannot be spliced to, what is already in the pipe is written out by hand
+                supported = out_size < 0 && errno == EINVAL ? false : supported;
+                char buffer[MAX_MSG_SIZE];
+                ssize_t read_size;
+                while (in_size > 0 && (read_size = read(pipe_fd[0], buffer, std::min<ssize_t>(sizeof(buffer), in_size))) > 0) {
+                    if (pwrite(fd, buffer, read_size, offset + received) != read_size)
+                        in_size = 0;
+                    else {
+                        received += read_size;
+                        in_size -= read_size;
+                    }
+                }
+                close(pipe_fd[0]);
+                close(pipe_fd[1]);
+                return received;
+            }
+            received += out_size;
+            in_size -= out_size;
+        }
+    }
+    close(pipe_fd[0]);
+    close(pipe_fd[1]);
+    return received;
+}
+
+// read past length bytes of a file which is not wanted, so the next reply on the connection can be read
+inline bool skip_file_range(int socket_fd, int64_t length) {
+    char buffer[MAX_MSG_SIZE];
+    while (length > 0) {
+        ssize_t received_size = recv(socket_fd, buffer, std::min<int64_t>(sizeof(buffer), length), 0);
+        if (received_size < 0 && errno == EINTR)
+            continue;
+        if (received_size <= 0)
+            return false;
+        length -= received_size;
+    }
+    return true;
+}
+
+// receive up to length bytes into a file starting at offset
+// returns how many bytes were written, which is less than length if the connection closed early
+inline int64_t recv_file_range(int socket_fd, int fd, int64_t offset, int64_t length) {
+    // reserve the blocks up front without changing the size, so the size of a part file still says how much arrived
+    if (length > 0)
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, length);
+    bool supported;
+    int64_t received = recv_file_splice(socket_fd, fd, offset, length, supported);
+    if (!supported && received < length)
+        received += recv_file_copy(socket_fd, fd, offset + received, length - received);
+    return received;
+}
+
+#endif